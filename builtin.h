@@ -0,0 +1,32 @@
+/******************************************************************************
+ *
+ *  File Name........: builtin.h
+ *
+ *  Description......: header file for the builtins that load adds to
+ *  the shell.  A shared object to load defines
+ *
+ *	int ush_init(void);
+ *
+ *  which calls add_builtin() for each builtin it has, and returns 0 or,
+ *  if it can't work, non-zero.  A builtin is called with the command,
+ *  its words expanded and its redirections done, and returns its exit
+ *  status, as those of the shell do:
+ *
+ *	static int hello(Cmd c) { printf("hello %s\n", c->args[1]); return 0; }
+ *	int ush_init(void) { return add_builtin("hello", hello); }
+ *
+ *	cc -shared -fPIC -I ush-source -o hello.so hello.c
+ *
+ *  Its output goes through stdout, which is flushed after it.
+ *
+ *****************************************************************************/
+
+#ifndef BUILTIN_H
+#define BUILTIN_H
+
+#include "parse.h"
+
+int add_builtin(char *name, int (*exec_cmd)(Cmd));
+
+#endif /* BUILTIN_H */
+/*........................ end of builtin.h .................................*/
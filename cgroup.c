@@ -0,0 +1,322 @@
+/******************************************************************************
+ *
+ *  File Name........: cgroup.c
+ *
+ *  Description......:
+ *	Runs each foreground pipe in a cgroup v2 group of its own, when the
+ *  environment variable cgroup names a directory in the cgroup2 file
+ *  system to create them in (setenv cgroup /sys/fs/cgroup/ush).  The
+ *  children are started right in the group with clone3()'s
+ *  CLONE_INTO_CGROUP, and the group is given the control file settings
+ *  made with limit (limit memory.max 512M).  When the pipe is done the
+ *  CPU time and the peak memory of the group are told, and the group is
+ *  removed.
+ *
+ *****************************************************************************/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/limits.h>
+#include <linux/sched.h>
+#include "cgroup.h"
+
+#define MAX_SET		16	// control files set with limit
+
+// static variables
+static struct {
+  char *file;			// e.g. memory.max
+  char *value;
+} Set[MAX_SET];
+static int NSet;
+static int Cur = -1;		// directory of the group of the current pipe
+static char Path[PATH_MAX];	// its name
+static int Seq;			// groups made so far
+
+// forward decls
+static int writeFile(int, const char *, const char *);
+static long long readKey(const char *, const char *);
+
+/*-----------------------------------------------------------------------------
+ *
+ * Name...........: cgroupSet
+ *
+ * Description....: sets the value a control file is given in the
+ * group of each pipe, or removes it.
+ *
+ * Input Param(s).: const char *file -- the control file, e.g. cpu.max,
+ *		NULL for all of them
+ *		const char *value -- what to write, NULL to remove it
+ *
+ * Return Value(s): 0, or -1 if there are too many
+ *
+ */
+
+int cgroupSet(const char *file, const char *value)
+{
+  int i;
+
+  if ( file == NULL ) {
+    while ( NSet > 0 ) {
+      NSet--;
+      free(Set[NSet].file);
+      free(Set[NSet].value);
+    }
+    return 0;
+  }
+
+  for ( i = 0; i < NSet && strcmp(Set[i].file, file) != 0; i++ )
+    ;
+  if ( i < NSet ) {
+    free(Set[i].value);
+    if ( value == NULL ) {
+      free(Set[i].file);
+      Set[i] = Set[--NSet];
+      return 0;
+    }
+  } else {
+    if ( value == NULL )
+      return 0;
+    if ( NSet == MAX_SET )
+      return -1;
+    Set[NSet++].file = strdup(file);
+  }
+  Set[i].value = strdup(value);
+  return 0;
+} /*---------- End of cgroupSet ---------------------------------------------*/
+
+/*-----------------------------------------------------------------------------
+ *
+ * Name...........: cgroupList
+ *
+ * Description....: prints the control file settings.
+ *
+ * Input Param(s).: none
+ *
+ * Return Value(s): none
+ *
+ */
+
+void cgroupList()
+{
+  int i;
+
+  for ( i = 0; i < NSet; i++ )
+    printf("%-16s%s\n", Set[i].file, Set[i].value);
+} /*---------- End of cgroupList --------------------------------------------*/
+
+/*-----------------------------------------------------------------------------
+ *
+ * Name...........: cgroupStart
+ *
+ * Description....: creates the group for a pipe, if groups are asked
+ * for, and sets it up.  The controllers of the settings are enabled in
+ * the parent directory first; one that can't be is reported, and its
+ * settings then fail too.  A pipe started while one is running (e.g. in
+ * a { } group) stays in that one's group.
+ *
+ * Input Param(s).: none
+ *
+ * Return Value(s): 0 if the pipe has a group of its own now, else -1
+ *
+ */
+
+int cgroupStart()
+{
+  char *root, ctrl[64];
+  int i, fd;
+
+  root = getenv("cgroup");
+  if ( root == NULL || *root == '\0' || Cur >= 0 )
+    return -1;
+
+  fd = open(root, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if ( fd < 0 ) {
+    fprintf(stderr, "%s: %s.\n", root, strerror(errno));
+    return -1;
+  }
+  for ( i = 0; i < NSet; i++ ) {	// e.g. +memory for memory.max
+    snprintf(ctrl, sizeof(ctrl), "+%.*s", (int)strcspn(Set[i].file, "."),
+	     Set[i].file);
+    if ( writeFile(fd, "cgroup.subtree_control", ctrl) < 0 )
+      fprintf(stderr, "%s/cgroup.subtree_control: %s: %s.\n", root, ctrl,
+	      strerror(errno));
+  }
+  close(fd);
+
+  snprintf(Path, sizeof(Path), "%s/ush-%d-%d", root, getpid(), ++Seq);
+  if ( mkdir(Path, 0755) < 0 ) {
+    fprintf(stderr, "%s: %s.\n", Path, strerror(errno));
+    return -1;
+  }
+  Cur = open(Path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if ( Cur < 0 ) {
+    fprintf(stderr, "%s: %s.\n", Path, strerror(errno));
+    rmdir(Path);
+    return -1;
+  }
+  for ( i = 0; i < NSet; i++ )
+    if ( writeFile(Cur, Set[i].file, Set[i].value) < 0 )
+      fprintf(stderr, "%s: %s.\n", Set[i].file, strerror(errno));
+  return 0;
+} /*---------- End of cgroupStart -------------------------------------------*/
+
+/*-----------------------------------------------------------------------------
+ *
+ * Name...........: cgroupFork
+ *
+ * Description....: fork(), into the group of the current pipe if there
+ * is one.  clone3() puts the child right into it, so not even its first
+ * instructions run outside.  Where that can't be done (before Linux 5.7)
+ * the child moves itself.  The child of a bare clone3() has a stale
+ * thread id in the C library, which is only used to signal threads, and
+ * the shell has no threads then.  Output a builtin has buffered is
+ * written first.
+ *
+ * Input Param(s).: none
+ *
+ * Return Value(s): as fork()
+ *
+ */
+
+pid_t cgroupFork()
+{
+  struct clone_args args;
+  pid_t pid;
+  int fd;
+
+  fflush(stdout);		// or the child would write it again
+  if ( Cur < 0 )
+    return fork();
+
+  memset(&args, 0, sizeof(args));
+  args.flags = CLONE_INTO_CGROUP;
+  args.exit_signal = SIGCHLD;
+  args.cgroup = Cur;
+  pid = syscall(SYS_clone3, &args, sizeof(args));
+  if ( pid >= 0 )
+    return pid;
+
+  pid = fork();
+  if ( pid == 0 ) {
+    fd = openat(Cur, "cgroup.procs", O_WRONLY | O_CLOEXEC);
+    if ( fd < 0 || write(fd, "0", 1) < 0 )
+      fprintf(stderr, "%s: %s.\n", Path, strerror(errno));
+    if ( fd >= 0 )
+      close(fd);
+  }
+  return pid;
+} /*---------- End of cgroupFork --------------------------------------------*/
+
+/*-----------------------------------------------------------------------------
+ *
+ * Name...........: cgroupEnd
+ *
+ * Description....: tells the CPU time and the peak memory of the group
+ * of the pipe that is done, and removes the group.
+ *
+ * Input Param(s).: none
+ *
+ * Return Value(s): none
+ *
+ */
+
+void cgroupEnd()
+{
+  long long user, sys, peak;
+
+  if ( Cur < 0 )
+    return;
+  user = readKey("cpu.stat", "user_usec");
+  sys = readKey("cpu.stat", "system_usec");
+  peak = readKey("memory.peak", NULL);	// since Linux 5.19
+  if ( user >= 0 && sys >= 0 ) {
+    fprintf(stderr, "%lld.%03lldu %lld.%03llds", user / 1000000,
+	    user / 1000 % 1000, sys / 1000000, sys / 1000 % 1000);
+    if ( peak >= 0 )
+      fprintf(stderr, " %lldk", peak / 1024);
+    fprintf(stderr, "\n");
+  }
+  close(Cur);
+  Cur = -1;
+  if ( rmdir(Path) < 0 )	// something the pipe started is still in it
+    fprintf(stderr, "%s: %s.\n", Path, strerror(errno));
+} /*---------- End of cgroupEnd ---------------------------------------------*/
+
+/*-----------------------------------------------------------------------------
+ *
+ * Name...........: writeFile
+ *
+ * Description....: writes a value to a control file.
+ *
+ * Input Param(s).: int dir -- the group's directory
+ *		const char *file -- the control file
+ *		const char *value -- the value
+ *
+ * Return Value(s): 0, or -1 (errno is set)
+ *
+ */
+
+static int writeFile(int dir, const char *file, const char *value)
+{
+  ssize_t r;
+  int fd;
+
+  fd = openat(dir, file, O_WRONLY | O_CLOEXEC);
+  if ( fd < 0 )
+    return -1;
+  r = write(fd, value, strlen(value));
+  close(fd);
+  return r < 0 ? -1 : 0;
+} /*---------- End of writeFile ---------------------------------------------*/
+
+/*-----------------------------------------------------------------------------
+ *
+ * Name...........: readKey
+ *
+ * Description....: reads a number from a control file of the current
+ * group: the value of a key in a file of "key value" lines, or the
+ * file's only value.
+ *
+ * Input Param(s).: const char *file -- the control file
+ *		const char *key -- the key, or NULL
+ *
+ * Return Value(s): the number, or -1 if there is none
+ *
+ */
+
+static long long readKey(const char *file, const char *key)
+{
+  char buf[1024], *p;
+  ssize_t n;
+  size_t len;
+  int fd;
+
+  fd = openat(Cur, file, O_RDONLY | O_CLOEXEC);
+  if ( fd < 0 )
+    return -1;
+  n = read(fd, buf, sizeof(buf) - 1);
+  close(fd);
+  if ( n <= 0 )
+    return -1;
+  buf[n] = '\0';
+  if ( key == NULL )
+    return atoll(buf);
+
+  len = strlen(key);
+  for ( p = buf; p != NULL && *p != '\0'; p = strchr(p, '\n') ) {
+    if ( *p == '\n' )
+      p++;
+    if ( strncmp(p, key, len) == 0 && p[len] == ' ' )
+      return atoll(p + len + 1);
+  }
+  return -1;
+} /*---------- End of readKey -----------------------------------------------*/
+
+/*........................ end of cgroup.c ..................................*/
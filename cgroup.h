@@ -0,0 +1,21 @@
+/******************************************************************************
+ *
+ *  File Name........: cgroup.h
+ *
+ *  Description......: header file for running ush pipes in cgroups.
+ *
+ *****************************************************************************/
+
+#ifndef CGROUP_H
+#define CGROUP_H
+
+#include <sys/types.h>
+
+int cgroupSet(const char *, const char *);
+void cgroupList();
+int cgroupStart();
+pid_t cgroupFork();
+void cgroupEnd();
+
+#endif /* CGROUP_H */
+/*........................ end of cgroup.h ..................................*/
@@ -0,0 +1,667 @@
+/******************************************************************************
+ *
+ *  File Name........: event.c
+ *
+ *  Description......:
+ *	The event loop of the ush shell.  The shell blocks SIGCHLD, SIGINT
+ *  and SIGTERM and reads them from a signalfd, and watches each child it
+ *  starts through a pidfd.  Both, and the terminal while the shell waits
+ *  for a line, are multiplexed with one epoll instance: the shell never
+ *  sits in a blocking wait() and runs no code in signal handlers.
+ *	Background (&) pipes become jobs, whose children are reaped as they
+ *  exit; the shell tells when a job is done before the next prompt.
+ *
+ *****************************************************************************/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include "parse.h"
+#include "event.h"
+
+#define MAX_EVENTS	16	// events taken from epoll at once
+#define FIRST_FD	10	// lowest descriptor the shell keeps for itself
+
+/* a child of the shell */
+struct child_t {
+  pid_t pid;
+  int fd;			// its pidfd, -1 if there is none
+  int job;			// number of its job, 0 if in the foreground
+  int done;			// has exited, status is valid
+  int status;
+};
+
+/* a background pipe */
+struct job_t {
+  int num;			// [num] as shown to the user
+  int left;			// children still running
+  char *text;			// the command
+  struct job_t *next;
+};
+
+// static variables
+static int Ep = -1;		// the epoll instance
+static int SigFd = -1;		// the signalfd
+static sigset_t Mask, OldMask;	// signals read from SigFd, mask before
+static int Interactive;		// ignore SIGTERM
+static int Intr;		// a SIGINT came
+static struct child_t *Child;
+static int NChild, MaxChild;
+static struct job_t *Jobs;
+
+// forward decls
+static void setup();
+static int poll1(int, int);
+static void readSignals();
+static void reapChild(int);
+static void dropChild(int);
+
+/*-----------------------------------------------------------------------------
+ *
+ * Name...........: eventInit
+ *
+ * Description....: blocks the signals the shell reads from its
+ * signalfd, and sets up the event loop.  The mask before is kept for
+ * the commands the shell runs.
+ *
+ * Input Param(s).: int interactive -- 1 if the shell reads a terminal,
+ * it then survives a SIGTERM
+ *
+ * Return Value(s): none
+ *
+ */
+
+void eventInit(int interactive)
+{
+  sigemptyset(&Mask);
+  sigaddset(&Mask, SIGCHLD);
+  sigaddset(&Mask, SIGINT);
+  sigaddset(&Mask, SIGTERM);
+  sigprocmask(SIG_BLOCK, &Mask, &OldMask);
+  signal(SIGINT, SIG_DFL);	// an ignored signal never gets to SigFd
+  Interactive = interactive;
+  setup();
+} /*---------- End of eventInit ---------------------------------------------*/
+
+/*-----------------------------------------------------------------------------
+ *
+ * Name...........: eventFork
+ *
+ * Description....: called in a child right after fork(): drops the
+ * event loop of the parent (its epoll instance is shared with the
+ * child) and forgets the parent's children and jobs.  If the child
+ * goes on as a shell, it gets a loop of its own when it needs one.
+ * The input the shell has read ahead is dropped too.
+ *
+ * Input Param(s).: none
+ *
+ * Return Value(s): none
+ *
+ */
+
+void eventFork()
+{
+  struct job_t *j;
+
+  if ( Ep >= 0 )
+    close(Ep);
+  if ( SigFd >= 0 )
+    close(SigFd);
+  Ep = SigFd = -1;
+  while ( NChild > 0 )
+    if ( Child[--NChild].fd >= 0 )
+      close(Child[NChild].fd);
+  while ( (j = Jobs) != NULL ) {
+    Jobs = j->next;
+    free(j->text);
+    free(j);
+  }
+  Interactive = 0;
+  parseFork();
+} /*---------- End of eventFork ---------------------------------------------*/
+
+/*-----------------------------------------------------------------------------
+ *
+ * Name...........: eventExec
+ *
+ * Description....: called in a child before it runs a command: gives
+ * back the signal mask the shell was started with.
+ *
+ * Input Param(s).: none
+ *
+ * Return Value(s): none
+ *
+ */
+
+void eventExec()
+{
+  sigprocmask(SIG_SETMASK, &OldMask, NULL);
+} /*---------- End of eventExec ---------------------------------------------*/
+
+/*-----------------------------------------------------------------------------
+ *
+ * Name...........: eventUnblock
+ *
+ * Description....: called in a child that runs a builtin or a function
+ * of a pipeline: it has no prompt to come back to, so SIGINT and
+ * SIGTERM kill it, as they do the commands of the pipeline.  SIGCHLD
+ * stays read from the signalfd, for the children it may wait for.
+ *
+ * Input Param(s).: none
+ *
+ * Return Value(s): none
+ *
+ */
+
+void eventUnblock()
+{
+  sigset_t set;
+
+  sigemptyset(&set);
+  sigaddset(&set, SIGINT);
+  sigaddset(&set, SIGTERM);
+  sigprocmask(SIG_UNBLOCK, &set, NULL);
+} /*---------- End of eventUnblock ------------------------------------------*/
+
+/*-----------------------------------------------------------------------------
+ *
+ * Name...........: eventWatch
+ *
+ * Description....: watches a child the shell has started, until
+ * eventWait() returns it or it becomes part of a job.
+ *
+ * Input Param(s).: pid_t pid -- the child
+ *
+ * Return Value(s): 0
+ *
+ */
+
+int eventWatch(pid_t pid)
+{
+  struct epoll_event ev;
+  struct child_t *ch;
+
+  if ( Ep < 0 )
+    setup();
+  if ( NChild == MaxChild ) {
+    MaxChild = MaxChild ? 2*MaxChild : 16;
+    Child = realloc(Child, MaxChild*sizeof(*Child));
+    if ( Child == NULL ) {
+      perror("realloc");
+      exit(errno);
+    }
+  }
+  ch = &Child[NChild++];
+  ch->pid = pid;
+  ch->job = 0;
+  ch->done = 0;
+  ch->status = 0;
+  // a pidfd is close-on-exec; without one (before Linux 5.3) the
+  // child is looked for on each SIGCHLD
+  ch->fd = eventHighFd(syscall(SYS_pidfd_open, pid, 0));
+  if ( ch->fd >= 0 ) {
+    ev.events = EPOLLIN;
+    ev.data.fd = ch->fd;
+    if ( epoll_ctl(Ep, EPOLL_CTL_ADD, ch->fd, &ev) < 0 ) {
+      close(ch->fd);
+      ch->fd = -1;
+    }
+  }
+  return 0;
+} /*---------- End of eventWatch --------------------------------------------*/
+
+/*-----------------------------------------------------------------------------
+ *
+ * Name...........: eventWait
+ *
+ * Description....: waits for one of the given children to exit, and
+ * stops watching it.  Children that are not asked for but exit in the
+ * meantime are kept for a later call (a { } group run by the shell
+ * waits for its commands while the pipe around it is running).
+ *
+ * Input Param(s).: pid_t *pids -- the children
+ *		int n -- number of pids
+ *		int *status -- set to the wait status of the child
+ *		int ms -- how long to wait at most, -1 for no limit
+ *
+ * Return Value(s): the pid of the child, 0 if none exited in time, or
+ * -1 if none of them is watched.
+ *
+ */
+
+pid_t eventWait(pid_t *pids, int n, int *status, int ms)
+{
+  struct timespec now, end;
+  int i, k, found;
+  long left = -1;
+  pid_t pid;
+
+  if ( ms > 0 ) {
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    end.tv_sec += ms / 1000;
+    end.tv_nsec += (ms % 1000) * 1000000L;
+    if ( end.tv_nsec >= 1000000000L ) {
+      end.tv_sec++;
+      end.tv_nsec -= 1000000000L;
+    }
+  }
+
+  for ( ;; ) {
+    found = 0;
+    for ( i = 0; i < NChild; i++ ) {
+      if ( Child[i].job != 0 )
+	continue;
+      for ( k = 0; k < n && pids[k] != Child[i].pid; k++ )
+	;
+      if ( k == n )
+	continue;
+      if ( Child[i].done ) {
+	pid = Child[i].pid;
+	*status = Child[i].status;
+	dropChild(i);
+	return pid;
+      }
+      found = 1;
+    }
+    if ( !found )
+      return -1;
+
+    if ( ms > 0 ) {
+      clock_gettime(CLOCK_MONOTONIC, &now);
+      left = (end.tv_sec - now.tv_sec) * 1000L
+	+ (end.tv_nsec - now.tv_nsec + 999999L) / 1000000L;
+      if ( left <= 0 )
+	return 0;
+    } else if ( ms == 0 ) {
+      if ( left == 0 )		// had one look already
+	return 0;
+      left = 0;
+    }
+    poll1(left, -1);
+  }
+} /*---------- End of eventWait ---------------------------------------------*/
+
+/*-----------------------------------------------------------------------------
+ *
+ * Name...........: eventKill
+ *
+ * Description....: sends a signal to those of the given children that
+ * are still running, through their pidfds: a pid that has been reaped
+ * could belong to another process by now.
+ *
+ * Input Param(s).: pid_t *pids -- the children
+ *		int n -- number of pids
+ *		int sig -- the signal
+ *
+ * Return Value(s): none
+ *
+ */
+
+void eventKill(pid_t *pids, int n, int sig)
+{
+  int i, k;
+
+  for ( i = 0; i < NChild; i++ ) {
+    if ( Child[i].done )
+      continue;
+    for ( k = 0; k < n && pids[k] != Child[i].pid; k++ )
+      ;
+    if ( k == n )
+      continue;
+    if ( Child[i].fd >= 0 )
+      syscall(SYS_pidfd_send_signal, Child[i].fd, sig, NULL, 0);
+    else
+      kill(Child[i].pid, sig);	// not reaped yet, so it is still ours
+  }
+} /*---------- End of eventKill ---------------------------------------------*/
+
+/*-----------------------------------------------------------------------------
+ *
+ * Name...........: eventJob
+ *
+ * Description....: makes watched children a background job, and tells
+ * its number and the last pid.
+ *
+ * Input Param(s).: pid_t *pids -- the children of the pipe
+ *		int n -- number of pids
+ *		char *text -- the command, for the done message (the job
+ *		frees it)
+ *
+ * Return Value(s): none
+ *
+ */
+
+void eventJob(pid_t *pids, int n, char *text)
+{
+  struct job_t *j, **jp;
+  int i, k, num;
+
+  // the lowest number not in use, the list is kept sorted
+  num = 1;
+  for ( jp = &Jobs; *jp != NULL && (*jp)->num == num; jp = &(*jp)->next )
+    num++;
+  j = ckmalloc(sizeof(*j));
+  j->num = num;
+  j->left = 0;
+  j->text = text;
+  j->next = *jp;
+  *jp = j;
+
+  for ( i = 0; i < NChild; i++ ) {
+    for ( k = 0; k < n && pids[k] != Child[i].pid; k++ )
+      ;
+    if ( k == n || Child[i].job != 0 )
+      continue;
+    if ( Child[i].done ) {	// no need to watch it any more
+      dropChild(i--);
+      continue;
+    }
+    Child[i].job = num;
+    j->left++;
+  }
+  if ( n > 0 )
+    printf("[%d] %d\n", num, pids[n-1]);
+} /*---------- End of eventJob ----------------------------------------------*/
+
+/*-----------------------------------------------------------------------------
+ *
+ * Name...........: eventNotify
+ *
+ * Description....: reaps the children that have exited, without
+ * waiting, and tells which jobs are done.
+ *
+ * Input Param(s).: none
+ *
+ * Return Value(s): none
+ *
+ */
+
+void eventNotify()
+{
+  struct job_t *j, **jp;
+
+  if ( Ep < 0 )
+    return;
+  while ( poll1(0, -1) > 0 )
+    ;
+  for ( jp = &Jobs; (j = *jp) != NULL; ) {
+    if ( j->left > 0 ) {
+      jp = &j->next;
+      continue;
+    }
+    printf("[%d]    Done                 %s\n", j->num, j->text);
+    *jp = j->next;
+    free(j->text);
+    free(j);
+  }
+} /*---------- End of eventNotify -------------------------------------------*/
+
+/*-----------------------------------------------------------------------------
+ *
+ * Name...........: eventInput
+ *
+ * Description....: waits until there is input to read on a descriptor,
+ * reaping children in the meantime.  A regular file, which epoll can't
+ * watch, is always ready.
+ *
+ * Input Param(s).: int fd -- the input
+ *
+ * Return Value(s): 0 when there is input, -1 if a SIGINT came first
+ *
+ */
+
+int eventInput(int fd)
+{
+  struct epoll_event ev;
+  int ready;
+
+  if ( Ep < 0 )
+    setup();
+  ev.events = EPOLLIN;
+  ev.data.fd = fd;
+  if ( epoll_ctl(Ep, EPOLL_CTL_ADD, fd, &ev) < 0 )
+    return 0;
+  Intr = 0;
+  do {
+    ready = poll1(-1, fd);
+  } while ( ready != 2 && !Intr );
+  epoll_ctl(Ep, EPOLL_CTL_DEL, fd, NULL);
+  return ready == 2 ? 0 : -1;
+} /*---------- End of eventInput --------------------------------------------*/
+
+/*-----------------------------------------------------------------------------
+ *
+ * Name...........: eventPending
+ *
+ * Description....: handles the signals that came, without waiting, for
+ * the shell while it runs builtins only (a while loop of @ and test),
+ * which never gets to eventWait() or eventInput().
+ *
+ * Input Param(s).: none
+ *
+ * Return Value(s): 1 if a SIGINT came since the last call or since the
+ * shell last waited for input, else 0
+ *
+ */
+
+int eventPending()
+{
+  int intr;
+
+  if ( Ep < 0 )
+    setup();
+  readSignals();
+  intr = Intr;
+  Intr = 0;
+  return intr;
+} /*---------- End of eventPending ------------------------------------------*/
+
+/*-----------------------------------------------------------------------------
+ *
+ * Name...........: setup
+ *
+ * Description....: creates the epoll instance and the signalfd.
+ *
+ * Input Param(s).: none
+ *
+ * Return Value(s): none
+ *
+ */
+
+static void setup()
+{
+  struct epoll_event ev;
+
+  Ep = eventHighFd(epoll_create1(EPOLL_CLOEXEC));
+  if ( Ep < 0 ) {
+    perror("epoll_create1");
+    exit(errno);
+  }
+  SigFd = eventHighFd(signalfd(-1, &Mask, SFD_NONBLOCK | SFD_CLOEXEC));
+  if ( SigFd < 0 ) {
+    perror("signalfd");
+    exit(errno);
+  }
+  ev.events = EPOLLIN;
+  ev.data.fd = SigFd;
+  epoll_ctl(Ep, EPOLL_CTL_ADD, SigFd, &ev);
+} /*---------- End of setup -------------------------------------------------*/
+
+/*-----------------------------------------------------------------------------
+ *
+ * Name...........: poll1
+ *
+ * Description....: waits for events once, and handles them.
+ *
+ * Input Param(s).: int ms -- how long to wait at most, -1 for no limit
+ *		int infd -- input descriptor being waited for, or -1
+ *
+ * Return Value(s): 2 if infd is ready, 1 if there were other events,
+ * 0 if there were none.
+ *
+ */
+
+static int poll1(int ms, int infd)
+{
+  struct epoll_event ev[MAX_EVENTS];
+  int i, k, n, ret = 0;
+
+  n = epoll_wait(Ep, ev, MAX_EVENTS, ms);
+  for ( i = 0; i < n; i++ ) {
+    if ( ev[i].data.fd == infd ) {
+      ret = 2;
+      continue;
+    }
+    if ( ret == 0 )
+      ret = 1;
+    if ( ev[i].data.fd == SigFd ) {
+      readSignals();
+      continue;
+    }
+    for ( k = 0; k < NChild; k++ )
+      if ( Child[k].fd == ev[i].data.fd ) {
+	reapChild(k);
+	break;
+      }
+  }
+  return ret;
+} /*---------- End of poll1 -------------------------------------------------*/
+
+/*-----------------------------------------------------------------------------
+ *
+ * Name...........: readSignals
+ *
+ * Description....: reads the pending signals from the signalfd.
+ * SIGCHLD looks for children without a pidfd, SIGINT is noted (it is
+ * the commands it is meant for), SIGTERM ends a shell that is not
+ * interactive.
+ *
+ * Input Param(s).: none
+ *
+ * Return Value(s): none
+ *
+ */
+
+static void readSignals()
+{
+  struct signalfd_siginfo si;
+  int i;
+
+  while ( read(SigFd, &si, sizeof(si)) == sizeof(si) ) {
+    switch ( si.ssi_signo ) {
+    case SIGCHLD:
+      // backwards, reapChild() may move the last child to i
+      for ( i = NChild - 1; i >= 0; i-- )
+	if ( Child[i].fd < 0 && !Child[i].done )
+	  reapChild(i);
+      break;
+    case SIGINT:
+      Intr = 1;
+      break;
+    case SIGTERM:
+      if ( !Interactive )
+	exit(128 + SIGTERM);
+      break;
+    }
+  }
+} /*---------- End of readSignals --------------------------------------------*/
+
+/*-----------------------------------------------------------------------------
+ *
+ * Name...........: reapChild
+ *
+ * Description....: reaps a child if it has exited.  A foreground child
+ * is kept, done, for eventWait(); one of a job is dropped and counted.
+ *
+ * Input Param(s).: int i -- the child's index in Child
+ *
+ * Return Value(s): none
+ *
+ */
+
+static void reapChild(int i)
+{
+  struct job_t *j;
+  int status;
+  pid_t r;
+
+  while ( (r = waitpid(Child[i].pid, &status, WNOHANG)) < 0 && errno == EINTR )
+    ;
+  if ( r == 0 )			// still running
+    return;
+  if ( r < 0 )			// reaped by someone else, nothing to tell
+    status = 0;
+  if ( Child[i].fd >= 0 ) {
+    epoll_ctl(Ep, EPOLL_CTL_DEL, Child[i].fd, NULL);
+    close(Child[i].fd);
+    Child[i].fd = -1;
+  }
+  Child[i].done = 1;
+  Child[i].status = status;
+  if ( Child[i].job != 0 ) {
+    for ( j = Jobs; j != NULL && j->num != Child[i].job; j = j->next )
+      ;
+    if ( j != NULL )
+      j->left--;
+    dropChild(i);
+  }
+} /*---------- End of reapChild ---------------------------------------------*/
+
+/*-----------------------------------------------------------------------------
+ *
+ * Name...........: dropChild
+ *
+ * Description....: stops watching a child.
+ *
+ * Input Param(s).: int i -- the child's index in Child
+ *
+ * Return Value(s): none
+ *
+ */
+
+static void dropChild(int i)
+{
+  if ( Child[i].fd >= 0 ) {
+    epoll_ctl(Ep, EPOLL_CTL_DEL, Child[i].fd, NULL);
+    close(Child[i].fd);
+  }
+  Child[i] = Child[--NChild];
+} /*---------- End of dropChild ---------------------------------------------*/
+
+/*-----------------------------------------------------------------------------
+ *
+ * Name...........: eventHighFd
+ *
+ * Description....: moves a descriptor of the shell's out of the way of
+ * the low ones, which redirections use (exec 3>file would close it).
+ *
+ * Input Param(s).: int fd -- the descriptor, -1 is passed on
+ *
+ * Return Value(s): the new close-on-exec descriptor, or fd if it can't
+ * be moved
+ *
+ */
+
+int eventHighFd(int fd)
+{
+  int high;
+
+  if ( fd < 0 || fd >= FIRST_FD )
+    return fd;
+  high = fcntl(fd, F_DUPFD_CLOEXEC, FIRST_FD);
+  if ( high < 0 )
+    return fd;
+  close(fd);
+  return high;
+} /*---------- End of eventHighFd -------------------------------------------*/
+
+/*........................ end of event.c ...................................*/
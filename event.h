@@ -0,0 +1,28 @@
+/******************************************************************************
+ *
+ *  File Name........: event.h
+ *
+ *  Description......: header file for the ush event loop.
+ *
+ *****************************************************************************/
+
+#ifndef EVENT_H
+#define EVENT_H
+
+#include <sys/types.h>
+
+void eventInit(int);
+void eventFork();
+void eventExec();
+void eventUnblock();
+int eventWatch(pid_t);
+pid_t eventWait(pid_t *, int, int *, int);
+void eventKill(pid_t *, int, int);
+void eventJob(pid_t *, int, char *);
+void eventNotify();
+int eventInput(int);
+int eventPending();
+int eventHighFd(int);
+
+#endif /* EVENT_H */
+/*........................ end of event.h ...................................*/
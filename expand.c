@@ -0,0 +1,1186 @@
+/******************************************************************************
+ *
+ *  File Name........: expand.c
+ *
+ *  Description......:
+ *	Word expansion for ush.  expandCmd() is run on each command of a
+ *  pipe just before it is executed.  It first starts the commands of
+ *  <(command) and >(command) arguments, which become /dev/fd names of
+ *  pipes to them, and replaces each `command` by the output of the
+ *  command and each $variable by its value, split into words unless it
+ *  was inside double quotes.  It then removes the quote marks (CTLESC) left by the
+ *  lexer and replaces every word containing an unquoted '*', '?' or
+ *  '[...]' by the sorted list of path names it matches.
+ *
+ *	A "**" component matches any number of directories; those patterns
+ *  are handed to walkGlob() (walk.c), which scans the subtree in parallel.
+ *
+ *	Directories are read with getdents64(2) into a cache that lives
+ *  until expandFlush() is called at the end of the input line, so that
+ *  several patterns on the same (possibly huge) directory cost a single
+ *  scan.  A cached listing is only reused while the directory's inode
+ *  and mtime are unchanged, so commands that create or remove files
+ *  earlier on the same line are still seen.
+ *
+ *****************************************************************************/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/syscall.h>
+#include <linux/limits.h>
+#include "expand.h"
+#include "walk.h"
+#include "event.h"
+#include "var.h"
+
+#define DENTS_SIZE	(256*1024)	// getdents64 buffer
+#define CHUNK		(64*1024)	// read size for `command` output
+#define MAX_PROC	16		// <(command)s per pipe
+#define IsBlank(c)	((c)==' '||(c)=='\t'||(c)=='\n')
+
+// getdents64 record, see getdents64(2)
+struct dirent64_t {
+  uint64_t d_ino;
+  int64_t d_off;
+  unsigned short d_reclen;
+  unsigned char d_type;
+  char d_name[];
+};
+
+/* directory cache data structure
+ * linked list, one dcache_t for each directory read on the current line
+ */
+struct dcache_t {
+  char *path;			/* directory as named in the pattern */
+  dev_t dev;			/* identity and version of the listing */
+  ino_t ino;
+  struct timespec mtime;
+  int racy;			/* modified too recently to be trusted */
+  int n, max;			/* num entries (and size) */
+  unsigned *off;		/* offset of each name in names */
+  unsigned char *type;		/* d_type of each entry */
+  char *names;			/* NUL separated names */
+  unsigned len, size;		/* bytes used in names (and size) */
+  struct dcache_t *next;
+};
+typedef struct dcache_t *DCache;
+
+/* list of words produced by one pattern */
+struct wlist_t {
+  int n, max;
+  char **w;
+};
+
+/* growing string */
+struct sbuf_t {
+  char *s;
+  size_t n, max;
+};
+
+static DCache Cache;
+static char *Dents;
+
+// processes of the <(command)s of the current pipe, and our end of their pipe
+static struct {
+  pid_t pid;
+  int fd;
+} Proc[MAX_PROC];
+static int NProc;
+
+// extern functions and variables
+void process_pipe(Pipe);
+extern int last_status;
+extern int exit_after;
+extern pid_t shell_pid;
+
+// forward decls
+static int expand(Cmd, int, int);
+static int substCmd(Cmd, int);
+static int needSubst(const char *);
+static int substWord(char *, struct wlist_t *);
+static char *varValue(const char *, size_t, size_t *);
+static char *joinWords(char **, int);
+static char *runBackq(const char *, size_t, size_t *);
+static char *startProc(const char *);
+static void runSubshell(const char *, size_t);
+static void pushWord(struct wlist_t *, char *);
+static int hasMeta(const char *, const char *);
+static void unescape(char *);
+static DCache dcLookup(const char *);
+static int dcRead(DCache, const char *);
+static void globPath(char *, size_t, const char *, struct wlist_t *);
+static int globWord(const char *, struct wlist_t *);
+
+/*-----------------------------------------------------------------------------
+ *
+ * Name...........: expandCmd
+ *
+ * Description....: expands the words of a command in place.  `command`s
+ * are substituted, then arguments that are patterns are replaced by
+ * their (sorted) matches, all other words just lose their quote marks.
+ * The words of @ are an expression, in which * is no pattern, and those
+ * of unalias are patterns for alias names, not file names.
+ *
+ * Input Param(s).: Cmd c -- the command, as returned by parse()
+ *
+ * Return Value(s): 0, or -1 if a pattern matched nothing or another
+ * error occurred (a message has been printed and the command should
+ * not be run).
+ *
+ */
+
+int expandCmd(Cmd c)
+{
+  return expand(c, c->nargs == 0 || (strcmp(c->args[0], "@") != 0 &&
+				     strcmp(c->args[0], "unalias") != 0), 0);
+} /*---------- End of expandCmd ----------------------------------------------*/
+
+/*-----------------------------------------------------------------------------
+ *
+ * Name...........: expandList
+ *
+ * Description....: expands the words of a list that is not a command,
+ * such as the list of a foreach or the words of an expression, in
+ * place.  The list may come out empty.
+ *
+ * Input Param(s).: Cmd c -- the words, as made by wordPipe()
+ *		int glob -- 0 if patterns are words like any other
+ *
+ * Return Value(s): 0, or -1 on error (a message has been printed)
+ *
+ */
+
+int expandList(Cmd c, int glob)
+{
+  return expand(c, glob, 1);
+} /*---------- End of expandList ---------------------------------------------*/
+
+/*-----------------------------------------------------------------------------
+ *
+ * Name...........: expand
+ *
+ * Description....: expands the words of a command or a list.
+ *
+ * Input Param(s).: Cmd c -- the command
+ *		int glob -- 1 to replace patterns by their matches
+ *		int list -- 1 if c is not a command
+ *
+ * Return Value(s): 0, or -1 on error
+ *
+ */
+
+static int expand(Cmd c, int glob, int list)
+{
+  struct wlist_t l = {0, 0, NULL};
+  int i, n, nargs;
+  char **args;
+  Redir r;
+
+  if ( substCmd(c, list) < 0 )
+    return -1;
+
+  for ( r = c->redir; r != NULL; r = r->next )
+    if ( r->file != NULL && r->type != Theredoc )
+      unescape(r->file);
+
+  for ( i = 0; glob && i < c->nargs; i++ )
+    if ( hasMeta(c->args[i], NULL) )
+      break;
+  if ( !glob || i == c->nargs ) {	// nothing to glob, the usual case
+    for ( i = 0; i < c->nargs; i++ )
+      unescape(c->args[i]);
+    return 0;
+  }
+
+  // args points either to words of c->args or to matches kept in l
+  nargs = 0;
+  args = ckmalloc((c->nargs+1)*sizeof(char *));
+  for ( i = 0; i < c->nargs; i++ ) {
+    if ( !hasMeta(c->args[i], NULL) ) {
+      unescape(c->args[i]);
+      args[nargs++] = c->args[i];
+      continue;
+    }
+    n = l.n;
+    if ( globWord(c->args[i], &l) == 0 ) {
+      if ( nargs == 0 )
+	unescape(c->args[0]);
+      printf("%s: No match.\n", nargs ? args[0] : c->args[0]);
+      for ( n = 0; n < l.n; n++ )
+	free(l.w[n]);
+      free(l.w);
+      free(args);
+      return -1;
+    }
+    args = realloc(args, (nargs+l.n-n+c->nargs-i)*sizeof(char *));
+    if ( args == NULL ) {
+      perror("realloc");
+      exit(errno);
+    }
+    while ( n < l.n )
+      args[nargs++] = l.w[n++];
+    free(c->args[i]);		// the pattern itself is done
+    c->args[i] = NULL;
+  }
+  args[nargs] = NULL;
+  free(l.w);
+
+  free(c->args);
+  c->args = args;
+  c->nargs = nargs;
+  c->maxargs = nargs+1;
+  return 0;
+} /*---------- End of expand -------------------------------------------------*/
+
+/*-----------------------------------------------------------------------------
+ *
+ * Name...........: substCmd
+ *
+ * Description....: substitutes the <(command)s, `command`s and
+ * $variables in the words and the redirection file names of a command.
+ *
+ * Input Param(s).: Cmd c -- the command
+ *		int list -- 1 if c is a list of words, which may be empty
+ *
+ * Return Value(s): 0, or -1 on error (message printed)
+ *
+ */
+
+static int substCmd(Cmd c, int list)
+{
+  struct wlist_t l = {0, 0, NULL};
+  char *s;
+  int i, n;
+  Redir r;
+
+  for ( r = c->redir; r != NULL; r = r->next ) {
+    if ( r->file == NULL || r->type == Theredoc )	// a text, not a word
+      continue;
+    if ( *r->file == CTLPROC ) {
+      if ( (s = startProc(r->file)) == NULL )
+	return -1;
+      free(r->file);
+      r->file = s;
+    }
+    if ( !needSubst(r->file) )
+      continue;
+    l.n = 0;
+    n = substWord(r->file, &l);
+    if ( n < 0 || l.n != 1 ) {
+      if ( n == 0 )
+	printf("Ambiguous.\n");
+      while ( l.n > 0 )
+	free(l.w[--l.n]);
+      free(l.w);
+      return -1;
+    }
+    free(r->file);
+    r->file = l.w[0];
+  }
+
+  for ( i = 0; i < c->nargs; i++ )
+    if ( c->args[i][0] == CTLPROC ) {
+      if ( (s = startProc(c->args[i])) == NULL )
+	return -1;
+      free(c->args[i]);
+      c->args[i] = s;
+    }
+
+  for ( i = 0; i < c->nargs; i++ )
+    if ( needSubst(c->args[i]) )
+      break;
+  if ( i == c->nargs )
+    return 0;
+
+  // the output is split right into the new argument list
+  l.n = 0;
+  for ( n = 0, i = 0; i < c->nargs; i++ ) {
+    if ( needSubst(c->args[i]) ) {
+      if ( n == 0 && substWord(c->args[i], &l) < 0 )
+	n = -1;			// the other words are freed all the same
+      free(c->args[i]);
+    } else
+      pushWord(&l, c->args[i]);
+  }
+  pushWord(&l, NULL);
+  free(c->args);
+  c->args = l.w;
+  c->nargs = l.n - 1;
+  c->maxargs = l.max;
+  if ( n < 0 )
+    return -1;
+  if ( c->nargs == 0 && !list ) {
+    printf("Invalid null command.\n");
+    return -1;
+  }
+  return 0;
+} /*---------- End of substCmd ----------------------------------------------*/
+
+static void sbAdd(struct sbuf_t *b, char c)
+{
+  if ( b->n + 2 > b->max ) {
+    b->max = b->max ? 2*b->max : 64;
+    b->s = realloc(b->s, b->max);
+    if ( b->s == NULL ) {
+      perror("realloc");
+      exit(errno);
+    }
+  }
+  b->s[b->n++] = c;
+  b->s[b->n] = '\0';
+}
+
+/*-----------------------------------------------------------------------------
+ *
+ * Name...........: needSubst
+ *
+ * Description....: tells whether a word has `command`s or $variables.
+ *
+ * Input Param(s).: const char *w -- the word
+ *
+ * Return Value(s): 1 if it has, else 0
+ *
+ */
+
+static int needSubst(const char *w)
+{
+  return strchr(w, CTLBACKQ) != NULL || strchr(w, CTLVAR) != NULL;
+} /*---------- End of needSubst ---------------------------------------------*/
+
+/*-----------------------------------------------------------------------------
+ *
+ * Name...........: substWord
+ *
+ * Description....: substitutes the `command`s and $variables of a word.
+ * The output of a command, or the value of a variable, is split into
+ * words at blanks, the first and last of them joined to the text around
+ * it.  Inside double quotes it (less trailing newlines of the output)
+ * stays part of a single word.  The output is quoted, so it is not
+ * globbed.
+ *
+ * Input Param(s).: char *w -- the word
+ *		struct wlist_t *l -- list the resulting words are appended to
+ *
+ * Return Value(s): 0, or -1 if a variable is not set (message printed)
+ *
+ */
+
+static int substWord(char *w, struct wlist_t *l)
+{
+  struct sbuf_t cur = {NULL, 0, 0};
+  char *end, *out, *o;
+  int keep = 0, quoted;
+  size_t olen;
+
+  for ( ; *w; w++ ) {
+    quoted = 0;
+    if ( *w == CTLESC && (w[1] == CTLBACKQ || w[1] == CTLVAR) ) {
+      quoted = 1;
+      w++;
+    }
+    if ( *w != CTLBACKQ && *w != CTLVAR ) {
+      if ( *w == CTLESC && w[1] )
+	sbAdd(&cur, *w++);
+      sbAdd(&cur, *w);
+      keep = 1;
+      continue;
+    }
+
+    end = strchr(w+1, *w);
+    if ( *w == CTLVAR ) {
+      out = varValue(w+1, end-w-1, &olen);
+      if ( out == NULL ) {
+	free(cur.s);
+	return -1;
+      }
+    } else {
+      out = runBackq(w+1, end-w-1, &olen);
+      if ( quoted )
+	while ( out != NULL && olen > 0 && out[olen-1] == '\n' )
+	  olen--;
+    }
+    w = end;
+    if ( out == NULL )
+      continue;
+    for ( o = out; o < out+olen; o++ ) {
+      if ( !quoted && IsBlank(*o) ) {
+	if ( keep ) {
+	  pushWord(l, cur.s ? cur.s : strdup(""));
+	  cur.s = NULL;
+	  cur.n = cur.max = 0;
+	  keep = 0;
+	}
+	continue;
+      }
+      if ( ExpChar(*o) )
+	sbAdd(&cur, CTLESC);
+      sbAdd(&cur, *o);
+      keep = 1;
+    }
+    if ( quoted )
+      keep = 1;
+    free(out);
+  }
+
+  if ( keep )
+    pushWord(l, cur.s ? cur.s : strdup(""));
+  else
+    free(cur.s);
+  return 0;
+} /*---------- End of substWord ---------------------------------------------*/
+
+/*-----------------------------------------------------------------------------
+ *
+ * Name...........: varValue
+ *
+ * Description....: gets the value of a $variable: a shell variable, its
+ * words separated by blanks, else an environment variable.  $?name is 1
+ * if name is set, else 0, $#name its number of words, $$ the number of
+ * the shell's process and $status the status of the last command.
+ *
+ * Input Param(s).: const char *name -- the name (not terminated), with
+ *		the ? or # if any
+ *		size_t len -- its length
+ *		size_t *olen -- set to the length of the value
+ *
+ * Return Value(s): the value (on the heap), or NULL if the variable is
+ * not set (message printed)
+ *
+ */
+
+static char *varValue(const char *name, size_t len, size_t *olen)
+{
+  char buf[32], *n, *value, **words;
+  int i, count = 0;
+
+  n = strndup(name, len);
+  if ( *n == '?' || *n == '#' ) {
+    if ( (words = varGet(n+1, &count)) == NULL )
+      count = getenv(n+1) != NULL;
+    sprintf(buf, "%d", *n == '?' ? words != NULL || count > 0 : count);
+    value = strdup(buf);
+  } else if ( *n == '*' || (*n >= '1' && *n <= '9') ) {	// words of argv
+    if ( (words = varGet("argv", &count)) == NULL )
+      count = 0;
+    i = *n == '*' ? 0 : atoi(n);
+    value = i == 0 ? joinWords(words, count) : strdup(i <= count ? words[i-1] : "");
+  } else if ( (words = varGet(n, &count)) != NULL )
+    value = joinWords(words, count);
+  else if ( strcmp(n, "$") == 0 || strcmp(n, "status") == 0 ) {
+    sprintf(buf, "%d", *n == '$' ? (int)shell_pid : last_status);
+    value = strdup(buf);
+  } else if ( (value = getenv(n)) != NULL )
+    value = strdup(value);
+  else
+    printf("%s: Undefined variable.\n", n);
+
+  free(n);
+  if ( value != NULL )
+    *olen = strlen(value);
+  return value;
+} /*---------- End of varValue ----------------------------------------------*/
+
+/*-----------------------------------------------------------------------------
+ *
+ * Name...........: joinWords
+ *
+ * Description....: makes the value of a list of words, separated by a
+ * blank.
+ *
+ * Input Param(s).: char **words -- the words
+ *		int n -- how many
+ *
+ * Return Value(s): the value, on the heap
+ *
+ */
+
+static char *joinWords(char **words, int n)
+{
+  char *value;
+  size_t size;
+  int i;
+
+  for ( size = 1, i = 0; i < n; i++ )
+    size += strlen(words[i]) + 1;
+  value = ckmalloc(size);
+  value[0] = '\0';
+  for ( i = 0; i < n; i++ ) {
+    if ( i > 0 )
+      strcat(value, " ");
+    strcat(value, words[i]);
+  }
+  return value;
+} /*---------- End of joinWords ---------------------------------------------*/
+
+/*-----------------------------------------------------------------------------
+ *
+ * Name...........: runBackq
+ *
+ * Description....: runs the text of a `command` in a subshell whose
+ * standard output is a pipe, and collects what it writes, reading the
+ * pipe in large chunks.
+ *
+ * Input Param(s).: const char *text -- the command line (not terminated)
+ *		size_t len -- its length
+ *		size_t *olen -- set to the length of the output
+ *
+ * Return Value(s): the output (NUL terminated, on the heap), or NULL
+ *
+ */
+
+static char *runBackq(const char *text, size_t len, size_t *olen)
+{
+  size_t n, size;
+  ssize_t r;
+  char *buf;
+  int fds[2];
+  pid_t pid;
+
+  if ( pipe(fds) < 0 ) {
+    perror("pipe");
+    return NULL;
+  }
+  fflush(stdout);
+  pid = fork();
+  if ( pid < 0 ) {
+    perror("fork");
+    close(fds[0]);
+    close(fds[1]);
+    return NULL;
+  }
+
+  if ( pid == 0 ) {
+    close(fds[0]);
+    dup2(fds[1], 1);
+    close(fds[1]);
+    runSubshell(text, len);
+  }
+
+  close(fds[1]);
+  n = 0;
+  size = CHUNK;
+  buf = ckmalloc(size+1);
+  for ( ;; ) {
+    if ( size - n < CHUNK ) {
+      size *= 2;
+      buf = realloc(buf, size+1);
+      if ( buf == NULL ) {
+	perror("realloc");
+	exit(errno);
+      }
+    }
+    r = read(fds[0], buf+n, size-n);
+    if ( r < 0 && errno == EINTR )
+      continue;
+    if ( r <= 0 )
+      break;
+    n += r;
+  }
+  close(fds[0]);
+  while ( waitpid(pid, NULL, 0) < 0 && errno == EINTR )
+    ;
+
+  buf[n] = '\0';
+  *olen = n;
+  return buf;
+} /*---------- End of runBackq ----------------------------------------------*/
+
+/*-----------------------------------------------------------------------------
+ *
+ * Name...........: startProc
+ *
+ * Description....: starts the command of a <(command) or >(command)
+ * in a subshell, with its standard output (or input) on a pipe.  The
+ * shell keeps the other end open, without close-on-exec, so the command
+ * the argument is passed to can open it by its /dev/fd name.
+ * expandReap() closes it and waits for the subshell.
+ *
+ * Input Param(s).: const char *w -- the word: CTLPROC, '<' or '>', text
+ *
+ * Return Value(s): the /dev/fd name (on the heap), or NULL on error
+ *
+ */
+
+static char *startProc(const char *w)
+{
+  char name[32];
+  int fds[2], keep, other;
+  pid_t pid;
+
+  if ( NProc == MAX_PROC ) {
+    printf("Too many process substitutions.\n");
+    return NULL;
+  }
+  if ( pipe(fds) < 0 ) {
+    perror("pipe");
+    return NULL;
+  }
+  keep = w[1] == '<' ? fds[0] : fds[1];
+  other = w[1] == '<' ? fds[1] : fds[0];
+
+  fflush(stdout);
+  pid = fork();
+  if ( pid < 0 ) {
+    perror("fork");
+    close(fds[0]);
+    close(fds[1]);
+    return NULL;
+  }
+  if ( pid == 0 ) {
+    close(keep);
+    dup2(other, w[1] == '<' ? 1 : 0);
+    close(other);
+    runSubshell(w+2, strlen(w+2));
+  }
+
+  close(other);
+  Proc[NProc].pid = pid;
+  Proc[NProc++].fd = keep;
+  snprintf(name, sizeof(name), "/dev/fd/%d", keep);
+  return strdup(name);
+} /*---------- End of startProc ---------------------------------------------*/
+
+/*-----------------------------------------------------------------------------
+ *
+ * Name...........: expandReap
+ *
+ * Description....: closes the shell's end of the pipes of the current
+ * pipe's <(command)s and waits for their subshells.  Called once the
+ * pipe is done.
+ *
+ * Input Param(s).: none
+ *
+ * Return Value(s): none
+ *
+ */
+
+void expandReap()
+{
+  int i;
+
+  for ( i = 0; i < NProc; i++ )
+    close(Proc[i].fd);
+  for ( i = 0; i < NProc; i++ )
+    while ( waitpid(Proc[i].pid, NULL, 0) < 0 && errno == EINTR )
+      ;
+  NProc = 0;
+} /*---------- End of expandReap --------------------------------------------*/
+
+/*-----------------------------------------------------------------------------
+ *
+ * Name...........: runSubshell
+ *
+ * Description....: in a forked subshell, parses a command line and
+ * runs it.  Does not return.
+ *
+ * Input Param(s).: const char *text -- the command line (not terminated)
+ *		size_t len -- its length
+ *
+ * Return Value(s): none
+ *
+ */
+
+static void runSubshell(const char *text, size_t len)
+{
+  char *line;
+  FILE *in;
+  int i;
+
+  eventFork();
+  for ( i = 0; i < NProc; i++ )	// pipes of other <(command)s
+    close(Proc[i].fd);
+  NProc = 0;
+
+  line = ckmalloc(len+2);
+  memcpy(line, text, len);
+  line[len] = '\n';
+  line[len+1] = '\0';
+  if ( (in = fmemopen(line, len+1, "r")) == NULL )
+    exit(-1);
+  parseInput(in);
+  exit_after = 1;		// the last command can replace the subshell
+  process_pipe(parse());
+  exit(last_status);
+} /*---------- End of runSubshell --------------------------------------------*/
+
+/*-----------------------------------------------------------------------------
+ *
+ * Name...........: expandFlush
+ *
+ * Description....: drops the directory cache.  Called once the current
+ * input line has been executed.
+ *
+ * Input Param(s).: none
+ *
+ * Return Value(s): none
+ *
+ */
+
+void expandFlush()
+{
+  DCache d;
+
+  while ( Cache ) {
+    d = Cache;
+    Cache = d->next;
+    free(d->path);
+    free(d->off);
+    free(d->type);
+    free(d->names);
+    free(d);
+  }
+} /*---------- End of expandFlush --------------------------------------------*/
+
+/*-----------------------------------------------------------------------------
+ *
+ * Name...........: hasMeta
+ *
+ * Description....: tells whether a word (or the part of it before end)
+ * has an unquoted glob character.  A [ only counts with a ] after it.
+ *
+ * Input Param(s).: const char *s -- the word
+ *		const char *end -- where to stop, NULL for end of string
+ *
+ * Return Value(s): 1 if so, 0 otherwise
+ *
+ */
+
+static int hasMeta(const char *s, const char *end)
+{
+  const char *q;
+
+  for ( ; *s && s != end; s++ ) {
+    if ( *s == CTLESC ) {
+      if ( *++s == '\0' )
+	break;
+      continue;
+    }
+    if ( *s == '[' ) {		// without its ] it is an ordinary char, as in [ -f x ]
+      q = s+1;
+      if ( *q == '!' || *q == '^' )
+	q++;
+      if ( *q && q != end )	// a ] right after the [ is a member
+	q++;
+      while ( *q && q != end && *q != ']' )
+	q++;
+      if ( *q == ']' && q != end )
+	return 1;
+      continue;
+    }
+    if ( ExpChar(*s) )
+      return 1;
+  }
+  return 0;
+} /*---------- End of hasMeta -----------------------------------------------*/
+
+/*-----------------------------------------------------------------------------
+ *
+ * Name...........: unescape
+ *
+ * Description....: removes the CTLESC quote marks from a word, in place.
+ *
+ * Input Param(s).: char *s -- the word
+ *
+ * Return Value(s): none
+ *
+ */
+
+static void unescape(char *s)
+{
+  char *d;
+
+  if ( (s = strchr(s, CTLESC)) == NULL )
+    return;
+  for ( d = s; *s; s++ )
+    if ( *s != CTLESC )
+      *d++ = *s;
+  *d = '\0';
+} /*---------- End of unescape ----------------------------------------------*/
+
+/*-----------------------------------------------------------------------------
+ *
+ * Name...........: globMatch
+ *
+ * Description....: matches a name against one component of a pattern.
+ * Supports '*', '?' and '[...]' (with ranges and ! or ^ negation).  A
+ * character preceded by CTLESC only matches itself.
+ *
+ * Input Param(s).: const char *p -- the pattern component
+ *		const char *s -- the name
+ *
+ * Return Value(s): 1 on a match, 0 otherwise
+ *
+ */
+
+int globMatch(const char *p, const char *s)
+{
+  const char *q;
+  int neg, ok;
+  unsigned char lo, hi;
+
+  for ( ;; ) {
+    switch ( *p ) {
+    case '\0':
+      return *s == '\0';
+
+    case '*':
+      while ( *p == '*' )
+	p++;
+      if ( *p == '\0' )
+	return 1;
+      for ( ; *s; s++ )
+	if ( globMatch(p, s) )
+	  return 1;
+      return 0;
+
+    case '?':
+      if ( *s == '\0' )
+	return 0;
+      p++, s++;
+      break;
+
+    case '[':
+      if ( *s == '\0' )
+	return 0;
+      q = p+1;
+      neg = (*q == '!' || *q == '^');
+      if ( neg )
+	q++;
+      ok = 0;
+      do {
+	if ( *q == CTLESC )
+	  q++;
+	if ( *q == '\0' )
+	  break;
+	lo = hi = *q++;
+	if ( *q == '-' && q[1] != ']' && q[1] != '\0' ) {
+	  q++;
+	  if ( *q == CTLESC )
+	    q++;
+	  hi = *q++;
+	}
+	if ( (unsigned char)*s >= lo && (unsigned char)*s <= hi )
+	  ok = 1;
+      } while ( *q != ']' );
+      if ( *q == '\0' ) {	// no closing ], so [ is an ordinary char
+	if ( *s != '[' )
+	  return 0;
+	p++, s++;
+	break;
+      }
+      if ( ok == neg )
+	return 0;
+      p = q+1, s++;
+      break;
+
+    case CTLESC:
+      p++;
+      // fall through
+    default:
+      if ( *p != *s )
+	return 0;
+      p++, s++;
+      break;
+    }
+  }
+} /*---------- End of globMatch ---------------------------------------------*/
+
+/*-----------------------------------------------------------------------------
+ *
+ * Name...........: dcLookup
+ *
+ * Description....: returns the listing of a directory, reading it only
+ * if it is not cached yet or has changed since it was cached.
+ *
+ * Input Param(s).: const char *path -- the directory
+ *
+ * Return Value(s): the cache entry, or NULL if the directory can't be read
+ *
+ */
+
+static DCache dcLookup(const char *path)
+{
+  struct stat sb;
+  DCache d;
+
+  for ( d = Cache; d != NULL; d = d->next )
+    if ( strcmp(d->path, path) == 0 )
+      break;
+
+  if ( d != NULL ) {
+    if ( !d->racy && stat(path, &sb) == 0 && sb.st_dev == d->dev
+	 && sb.st_ino == d->ino && sb.st_mtim.tv_sec == d->mtime.tv_sec
+	 && sb.st_mtim.tv_nsec == d->mtime.tv_nsec )
+      return d;
+  } else {
+    d = ckmalloc(sizeof(*d));
+    memset(d, 0, sizeof(*d));
+    d->path = strdup(path);
+    d->next = Cache;
+    Cache = d;
+  }
+
+  if ( dcRead(d, path) < 0 )
+    return NULL;
+  return d;
+} /*---------- End of dcLookup ---------------------------------------------*/
+
+/*-----------------------------------------------------------------------------
+ *
+ * Name...........: dcRead
+ *
+ * Description....: (re)reads a directory into a cache entry with
+ * getdents64(2).  Timestamps come from the kernel's coarse clock, so
+ * a directory whose mtime is not older than the coarse time the scan
+ * started at is marked racy: a later change within the same clock tick
+ * (a few milliseconds) would not show in its mtime, so the listing is
+ * not reused.  Any older mtime would change with the directory.
+ *
+ * Input Param(s).: DCache d -- the entry to fill
+ *		const char *path -- the directory
+ *
+ * Return Value(s): 0, or -1 on error
+ *
+ */
+
+static int dcRead(DCache d, const char *path)
+{
+  struct dirent64_t *e;
+  struct timespec start;
+  struct stat sb;
+  long nread, pos;
+  size_t l;
+  int fd;
+
+  d->n = 0;
+  d->len = 0;
+  d->racy = 1;
+  clock_gettime(CLOCK_REALTIME_COARSE, &start);
+
+  fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if ( fd < 0 )
+    return -1;
+  if ( fstat(fd, &sb) < 0 ) {
+    close(fd);
+    return -1;
+  }
+  if ( Dents == NULL )
+    Dents = ckmalloc(DENTS_SIZE);
+
+  while ( (nread = syscall(SYS_getdents64, fd, Dents, DENTS_SIZE)) > 0 ) {
+    for ( pos = 0; pos < nread; pos += e->d_reclen ) {
+      e = (struct dirent64_t *)(Dents + pos);
+      l = strlen(e->d_name) + 1;
+      if ( d->n == d->max ) {
+	d->max = d->max ? 2*d->max : 64;
+	d->off = realloc(d->off, d->max*sizeof(*d->off));
+	d->type = realloc(d->type, d->max);
+	if ( d->off == NULL || d->type == NULL ) {
+	  perror("realloc");
+	  exit(errno);
+	}
+      }
+      while ( d->len + l > d->size ) {
+	d->size = d->size ? 2*d->size : 4096;
+	d->names = realloc(d->names, d->size);
+	if ( d->names == NULL ) {
+	  perror("realloc");
+	  exit(errno);
+	}
+      }
+      d->off[d->n] = d->len;
+      d->type[d->n++] = e->d_type;
+      memcpy(d->names + d->len, e->d_name, l);
+      d->len += l;
+    }
+  }
+  close(fd);
+  if ( nread < 0 )
+    return -1;
+
+  d->dev = sb.st_dev;
+  d->ino = sb.st_ino;
+  d->mtime = sb.st_mtim;
+  d->racy = sb.st_mtim.tv_sec > start.tv_sec ||
+    (sb.st_mtim.tv_sec == start.tv_sec && sb.st_mtim.tv_nsec >= start.tv_nsec);
+  return 0;
+} /*---------- End of dcRead -------------------------------------------------*/
+
+/*-----------------------------------------------------------------------------
+ *
+ * Name...........: pushWord
+ *
+ * Description....: appends a path name to a word list, which then owns it.
+ *
+ * Input Param(s).: struct wlist_t *l -- the list
+ *		char *s -- the path name, on the heap
+ *
+ * Return Value(s): none
+ *
+ */
+
+static void pushWord(struct wlist_t *l, char *s)
+{
+  if ( l->n + 1 > l->max ) {
+    l->max = l->max ? 2*l->max : 16;
+    l->w = realloc(l->w, l->max*sizeof(char *));
+    if ( l->w == NULL ) {
+      perror("realloc");
+      exit(errno);
+    }
+  }
+  l->w[l->n++] = s;
+} /*---------- End of pushWord -----------------------------------------------*/
+
+static void addWord(struct wlist_t *l, const char *s)
+{
+  pushWord(l, strdup(s));
+} /*---------- End of addWord ------------------------------------------------*/
+
+/*-----------------------------------------------------------------------------
+ *
+ * Name...........: globPath
+ *
+ * Description....: expands the rest of a pattern, one '/' separated
+ * component at a time, below the directory already in path.
+ *
+ * Input Param(s).: char *path -- PATH_MAX buffer holding the directory
+ * matched so far ("" for the current directory, else ending in '/')
+ *		size_t plen -- strlen(path)
+ *		const char *pat -- the remaining components of the pattern
+ *		struct wlist_t *l -- where to put matching path names
+ *
+ * Return Value(s): none
+ *
+ */
+
+static void globPath(char *path, size_t plen, const char *pat,
+		     struct wlist_t *l)
+{
+  char comp[NAME_MAX+1], *name, **w;
+  const char *end, *rest;
+  struct stat sb;
+  size_t clen, nlen;
+  DCache d;
+  int i, n;
+
+  end = strchr(pat, '/');
+  if ( end == NULL )
+    end = pat + strlen(pat);
+  for ( rest = end; *rest == '/'; rest++ )
+    ;
+  clen = end - pat;
+  if ( clen > NAME_MAX )
+    return;
+
+  if ( clen == 2 && pat[0] == '*' && pat[1] == '*' ) {	// whole subtree
+    if ( walkGlob(plen ? path : "", pat, &w, &n) >= 0 ) {	// w is there if none matched too
+      for ( i = 0; i < n; i++ )
+	pushWord(l, w[i]);
+      free(w);
+    }
+    return;
+  }
+
+  if ( !hasMeta(pat, end) ) {	// literal component, no need to read dir
+    if ( plen + clen + 2 > PATH_MAX )
+      return;
+    memcpy(path+plen, pat, clen);
+    path[plen+clen] = '\0';
+    unescape(path+plen);
+    nlen = plen + strlen(path+plen);
+    if ( *end == '/' ) {
+      path[nlen++] = '/';
+      path[nlen] = '\0';
+    }
+    if ( *rest )
+      globPath(path, nlen, rest, l);
+    else if ( lstat(path, &sb) == 0 )
+      addWord(l, path);
+    path[plen] = '\0';
+    return;
+  }
+
+  memcpy(comp, pat, clen);
+  comp[clen] = '\0';
+  if ( (d = dcLookup(plen ? path : ".")) == NULL )
+    return;
+
+  for ( i = 0; i < d->n; i++ ) {
+    name = d->names + d->off[i];
+    // dot files must be matched explicitly, . and .. never are
+    if ( name[0] == '.' && (comp[0] != '.' || name[1] == '\0'
+			    || (name[1] == '.' && name[2] == '\0')) )
+      continue;
+    if ( !globMatch(comp, name) )
+      continue;
+    nlen = strlen(name);
+    if ( plen + nlen + 2 > PATH_MAX )
+      continue;
+    memcpy(path+plen, name, nlen+1);
+    if ( *end == '/' ) {	// must be a directory to go on
+      if ( d->type[i] != DT_DIR ) {
+	if ( d->type[i] != DT_LNK && d->type[i] != DT_UNKNOWN )
+	  continue;
+	if ( stat(path, &sb) < 0 || !S_ISDIR(sb.st_mode) )
+	  continue;
+      }
+      path[plen+nlen] = '/';
+      path[plen+nlen+1] = '\0';
+      if ( *rest )
+	globPath(path, plen+nlen+1, rest, l);
+      else
+	addWord(l, path);
+    } else
+      addWord(l, path);
+  }
+  path[plen] = '\0';
+} /*---------- End of globPath -----------------------------------------------*/
+
+static int cmpWord(const void *a, const void *b)
+{
+  return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+/*-----------------------------------------------------------------------------
+ *
+ * Name...........: globWord
+ *
+ * Description....: expands a pattern into the sorted list of matching
+ * path names.
+ *
+ * Input Param(s).: const char *pat -- the pattern, with its quote marks
+ *		struct wlist_t *l -- list the matches are appended to
+ *
+ * Return Value(s): number of matches added to l
+ *
+ */
+
+static int globWord(const char *pat, struct wlist_t *l)
+{
+  char path[PATH_MAX];
+  size_t plen = 0;
+  int first = l->n;
+
+  path[0] = '\0';
+  if ( *pat == '/' ) {
+    path[plen++] = '/';
+    path[plen] = '\0';
+    while ( *pat == '/' )
+      pat++;
+  }
+  globPath(path, plen, pat, l);
+  qsort(l->w + first, l->n - first, sizeof(char *), cmpWord);
+  return l->n - first;
+} /*---------- End of globWord ----------------------------------------------*/
+
+/*........................ end of expand.c ..................................*/
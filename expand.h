@@ -0,0 +1,21 @@
+/******************************************************************************
+ *
+ *  File Name........: expand.h
+ *
+ *  Description......: header file for the ush word expansion stage.
+ *
+ *****************************************************************************/
+
+#ifndef EXPAND_H
+#define EXPAND_H
+
+#include "parse.h"
+
+int expandCmd(Cmd);
+int expandList(Cmd, int);
+void expandFlush();
+void expandReap();
+int globMatch(const char *, const char *);
+
+#endif /* EXPAND_H */
+/*........................ end of expand.h ..................................*/
@@ -0,0 +1,379 @@
+/******************************************************************************
+ *
+ *  File Name........: expr.c
+ *
+ *  Description......:
+ *	Evaluates the expressions of @ and of if and while, as in csh,
+ *  over 64-bit integers.  The operators, from the lowest precedence up:
+ *
+ *	||   &&   |   ^   &   == != =~ !~   <= >= < >   << >>   + -
+ *	* / %   and the unary ! ~ - +
+ *
+ *  with ( ) for grouping.  == and != compare strings unless an operand
+ *  was computed, =~ and !~ match a string against a pattern.  The
+ *  expression is parsed by precedence climbing right from the words of
+ *  the command, so evaluating one costs no process and no allocation.
+ *
+ *****************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include "expand.h"
+#include "expr.h"
+
+/* a value: a number, and the word it was if it was one */
+struct val_t {
+  long long n;
+  const char *s;		// NULL if computed
+};
+
+// static variables
+static const struct {
+  char *op;
+  int prec;
+} Ops[] = {
+  {"||", 1}, {"&&", 2}, {"|", 3}, {"^", 4}, {"&", 5},
+  {"==", 6}, {"!=", 6}, {"=~", 6}, {"!~", 6},
+  {"<=", 7}, {">=", 7}, {"<", 7}, {">", 7},
+  {"<<", 8}, {">>", 8}, {"+", 9}, {"-", 9},
+  {"*", 10}, {"/", 10}, {"%", 10}
+};
+static char **W;		// the words of the expression
+static int N, Pos;		// how many, the next one
+static int Err;			// an error has been told
+static int Skip;		// > 0 while parsing the unneeded side of && or ||
+
+// forward decls
+static int binary(int, struct val_t *);
+static int unary(struct val_t *);
+static int number(struct val_t *);
+static int apply(const char *, struct val_t *, struct val_t *);
+static int prec(const char *);
+
+/*-----------------------------------------------------------------------------
+ *
+ * Name...........: exprEval
+ *
+ * Description....: evaluates an expression.
+ *
+ * Input Param(s).: char **w -- its words, expanded
+ *		int n -- how many
+ *		long long *v -- set to the value
+ *
+ * Return Value(s): 0, or -1 if it is not a valid expression (message
+ * printed)
+ *
+ */
+
+int exprEval(char **w, int n, long long *v)
+{
+  struct val_t r;
+
+  W = w;
+  N = n;
+  Pos = 0;
+  Err = 0;
+  Skip = 0;
+  if ( n == 0 || binary(1, &r) < 0 || Pos < N ) {
+    if ( !Err )
+      printf("Expression Syntax.\n");
+    return -1;
+  }
+  if ( number(&r) < 0 )
+    return -1;
+  *v = r.n;
+  return 0;
+} /*---------- End of exprEval ----------------------------------------------*/
+
+/*-----------------------------------------------------------------------------
+ *
+ * Name...........: exprNumber
+ *
+ * Description....: converts a word to a number.  The empty word is 0.
+ *
+ * Input Param(s).: const char *s -- the word
+ *		long long *v -- set to the number
+ *
+ * Return Value(s): 0, or -1 if it is not a number (message printed)
+ *
+ */
+
+int exprNumber(const char *s, long long *v)
+{
+  char *end;
+
+  errno = 0;
+  *v = strtoll(s, &end, 10);
+  if ( *end != '\0' || errno != 0 ) {
+    printf("Badly formed number.\n");
+    return -1;
+  }
+  return 0;
+} /*---------- End of exprNumber --------------------------------------------*/
+
+/*-----------------------------------------------------------------------------
+ *
+ * Name...........: exprOp
+ *
+ * Description....: applies a binary operator to two numbers, for the
+ * op= of @.
+ *
+ * Input Param(s).: const char *op -- the operator, e.g. +
+ *		long long a, b -- the operands
+ *		long long *v -- set to the result
+ *
+ * Return Value(s): 0, or -1 on error (message printed)
+ *
+ */
+
+int exprOp(const char *op, long long a, long long b, long long *v)
+{
+  struct val_t x = {a, NULL}, y = {b, NULL};
+
+  if ( apply(op, &x, &y) < 0 )
+    return -1;
+  *v = x.n;
+  return 0;
+} /*---------- End of exprOp ------------------------------------------------*/
+
+/*-----------------------------------------------------------------------------
+ *
+ * Name...........: binary
+ *
+ * Description....: evaluates the words from Pos on, for as long as the
+ * operators bind at least as tightly as minprec.  All binary operators
+ * are left associative.  The right side of && and || is only parsed if
+ * the left one decides, so $n != 0 && 10 / $n can't divide by 0.
+ *
+ * Input Param(s).: int minprec -- the lowest precedence to take
+ *		struct val_t *v -- set to the value
+ *
+ * Return Value(s): 0, or -1 on error
+ *
+ */
+
+static int binary(int minprec, struct val_t *v)
+{
+  struct val_t r;
+  const char *op;
+  int p, cut, t;
+
+  if ( unary(v) < 0 )
+    return -1;
+  while ( Pos < N && (p = prec(W[Pos])) >= minprec ) {
+    op = W[Pos++];
+    cut = 0;
+    if ( (op[0] == '&' || op[0] == '|') && op[1] == op[0] ) {
+      if ( number(v) < 0 )
+	return -1;
+      cut = !Skip && (v->n != 0) == (op[0] == '|');
+    }
+    Skip += cut;
+    t = binary(p + 1, &r);
+    Skip -= cut;
+    if ( t < 0 )
+      return -1;
+    if ( cut ) {
+      v->n = op[0] == '|';
+      v->s = NULL;
+    } else if ( apply(op, v, &r) < 0 )
+      return -1;
+  }
+  return 0;
+} /*---------- End of binary -------------------------------------------------*/
+
+/*-----------------------------------------------------------------------------
+ *
+ * Name...........: unary
+ *
+ * Description....: evaluates a term: a word, ( expr ), or a unary
+ * operator and its term.
+ *
+ * Input Param(s).: struct val_t *v -- set to the value
+ *
+ * Return Value(s): 0, or -1 on error
+ *
+ */
+
+static int unary(struct val_t *v)
+{
+  const char *w;
+
+  if ( Pos == N )
+    return -1;
+  w = W[Pos++];
+
+  if ( strcmp(w, "(") == 0 ) {
+    if ( binary(1, v) < 0 || Pos == N || strcmp(W[Pos], ")") != 0 )
+      return -1;
+    Pos++;
+    v->s = NULL;		// (a) == b compares numbers
+    return number(v);
+  }
+
+  if ( (strcmp(w, "!") == 0 || strcmp(w, "~") == 0 ||
+	strcmp(w, "-") == 0 || strcmp(w, "+") == 0) && Pos < N ) {
+    if ( unary(v) < 0 || number(v) < 0 )
+      return -1;
+    v->s = NULL;
+    if ( *w == '!' )
+      v->n = !v->n;
+    else if ( *w == '~' )
+      v->n = ~v->n;
+    else if ( *w == '-' )
+      v->n = (long long)-(unsigned long long)v->n;
+    return 0;
+  }
+
+  if ( prec(w) > 0 || strcmp(w, ")") == 0 )	// an operator is no term
+    return -1;
+  v->s = w;
+  return 0;
+} /*---------- End of unary --------------------------------------------------*/
+
+/*-----------------------------------------------------------------------------
+ *
+ * Name...........: number
+ *
+ * Description....: makes sure a value has its number, converting the
+ * word it is if need be.
+ *
+ * Input Param(s).: struct val_t *v -- the value
+ *
+ * Return Value(s): 0, or -1 if the word is not a number
+ *
+ */
+
+static int number(struct val_t *v)
+{
+  if ( v->s == NULL || Skip )
+    return 0;
+  if ( exprNumber(v->s, &v->n) < 0 ) {
+    Err = 1;
+    return -1;
+  }
+  return 0;
+} /*---------- End of number -------------------------------------------------*/
+
+/*-----------------------------------------------------------------------------
+ *
+ * Name...........: apply
+ *
+ * Description....: applies a binary operator.  Arithmetic wraps around
+ * rather than overflowing.
+ *
+ * Input Param(s).: const char *op -- the operator
+ *		struct val_t *a -- the left operand, set to the result
+ *		struct val_t *b -- the right operand
+ *
+ * Return Value(s): 0, or -1 on error (message printed)
+ *
+ */
+
+static int apply(const char *op, struct val_t *a, struct val_t *b)
+{
+  unsigned long long x, y;
+
+  if ( Skip )
+    return 0;
+  if ( a->s != NULL && b->s != NULL ) {	// word against word
+    if ( strcmp(op, "==") == 0 || strcmp(op, "!=") == 0 ) {
+      a->n = (strcmp(a->s, b->s) == 0) == (*op == '=');
+      a->s = NULL;
+      return 0;
+    }
+  }
+  if ( strcmp(op, "=~") == 0 || strcmp(op, "!~") == 0 ) {
+    if ( a->s == NULL || b->s == NULL ) {
+      printf("Expression Syntax.\n");
+      Err = 1;
+      return -1;
+    }
+    a->n = globMatch(b->s, a->s) == (*op == '=');
+    a->s = NULL;
+    return 0;
+  }
+
+  if ( number(a) < 0 || number(b) < 0 )
+    return -1;
+  a->s = NULL;
+  x = a->n;
+  y = b->n;
+
+  switch ( op[0] ) {
+  case '|':
+    a->n = op[1] ? a->n || b->n : a->n | b->n;
+    break;
+  case '&':
+    a->n = op[1] ? a->n && b->n : a->n & b->n;
+    break;
+  case '^':
+    a->n ^= b->n;
+    break;
+  case '=':
+    a->n = a->n == b->n;
+    break;
+  case '!':
+    a->n = a->n != b->n;
+    break;
+  case '<':
+    if ( op[1] == '<' )
+      a->n = x << (y & 63);
+    else
+      a->n = op[1] ? a->n <= b->n : a->n < b->n;
+    break;
+  case '>':
+    if ( op[1] == '>' )
+      a->n >>= (y & 63);
+    else
+      a->n = op[1] ? a->n >= b->n : a->n > b->n;
+    break;
+  case '+':
+    a->n = x + y;
+    break;
+  case '-':
+    a->n = x - y;
+    break;
+  case '*':
+    a->n = x * y;
+    break;
+  case '/':
+  case '%':
+    if ( b->n == 0 ) {
+      printf(op[0] == '/' ? "Divide by 0.\n" : "Mod by 0.\n");
+      Err = 1;
+      return -1;
+    }
+    if ( b->n == -1 )		// the one quotient that would overflow
+      a->n = op[0] == '/' ? (long long)-x : 0;
+    else
+      a->n = op[0] == '/' ? a->n / b->n : a->n % b->n;
+    break;
+  }
+  return 0;
+} /*---------- End of apply --------------------------------------------------*/
+
+/*-----------------------------------------------------------------------------
+ *
+ * Name...........: prec
+ *
+ * Description....: tells the precedence of a binary operator.
+ *
+ * Input Param(s).: const char *w -- a word
+ *
+ * Return Value(s): the precedence, 0 if the word is no binary operator
+ *
+ */
+
+static int prec(const char *w)
+{
+  int i;
+
+  for ( i = 0; i < (int)(sizeof(Ops)/sizeof(Ops[0])); i++ )
+    if ( strcmp(w, Ops[i].op) == 0 )
+      return Ops[i].prec;
+  return 0;
+} /*---------- End of prec ---------------------------------------------------*/
+
+/*........................ end of expr.c ....................................*/
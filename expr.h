@@ -0,0 +1,17 @@
+/******************************************************************************
+ *
+ *  File Name........: expr.h
+ *
+ *  Description......: header file for the ush expression evaluator.
+ *
+ *****************************************************************************/
+
+#ifndef EXPR_H
+#define EXPR_H
+
+int exprEval(char **, int, long long *);
+int exprNumber(const char *, long long *);
+int exprOp(const char *, long long, long long, long long *);
+
+#endif /* EXPR_H */
+/*........................ end of expr.h ....................................*/
@@ -0,0 +1,159 @@
+/******************************************************************************
+ *
+ *  File Name........: input.c
+ *
+ *  Description......:
+ *	Reads a line for the read builtin, in blocks, without taking any
+ *  more of the input than the line: what follows is left for the
+ *  commands after read.  How depends on what the input is:
+ *
+ *	a file		a block is read and the rest of it given back
+ *			with lseek()
+ *	a pipe		the data is looked at with tee() into a pipe of
+ *			our own, then only the line is read
+ *	a terminal	read() stops at the end of a line anyway
+ *	anything else	a byte at a time
+ *
+ *  The shell waits for a pipe or a terminal in its event loop, where a
+ *  CTRL+C ends the wait.
+ *
+ *****************************************************************************/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "event.h"
+#include "input.h"
+
+#define BLOCK		4096
+
+// how a line is read
+typedef enum {Hseek, Hpeek, Hline, Hbyte} How;
+
+// static variables
+static int Peek[2] = {-1, -1};	// the pipe tee() copies into
+
+// forward decls
+static ssize_t peek(int, char *, size_t);
+
+/*-----------------------------------------------------------------------------
+ *
+ * Name...........: inputLine
+ *
+ * Description....: reads a line.  A last line without a newline is a
+ * line too.
+ *
+ * Input Param(s).: int fd -- the descriptor to read
+ *		size_t *len -- set to the length of the line
+ *
+ * Return Value(s): the line, malloc()ed, without its newline, or NULL
+ * at the end of the input or on an error (errno is set, 0 at the end,
+ * EINTR if a CTRL+C came while waiting at a terminal or a pipe)
+ *
+ */
+
+char *inputLine(int fd, size_t *len)
+{
+  struct stat st;
+  char *line = NULL, *nl = NULL;
+  size_t n = 0;
+  ssize_t r = 0, take;
+  How how;
+
+  if ( fstat(fd, &st) < 0 )
+    return NULL;
+  if ( S_ISREG(st.st_mode) && lseek(fd, 0, SEEK_CUR) >= 0 )
+    how = Hseek;
+  else if ( S_ISFIFO(st.st_mode) )
+    how = Hpeek;
+  else if ( isatty(fd) )
+    how = Hline;
+  else
+    how = Hbyte;
+
+  while ( nl == NULL ) {
+    line = realloc(line, n + BLOCK + 1);
+    if ( line == NULL ) {
+      perror("realloc");
+      exit(errno);
+    }
+    if ( (how == Hline || how == Hpeek) && eventInput(fd) < 0 ) {	// CTRL+C
+      errno = EINTR;
+      r = -1;
+      break;
+    }
+    if ( how == Hpeek ) {		// there is data, tee() won't block
+      r = peek(fd, line + n, BLOCK);
+      if ( r < 0 && errno == EINVAL ) {	// tee() doesn't do this pipe
+	how = Hbyte;
+	continue;
+      }
+    } else
+      r = read(fd, line + n, how == Hbyte ? 1 : BLOCK);
+    if ( r < 0 && errno == EINTR )
+      continue;
+    if ( r <= 0 )
+      break;
+
+    nl = memchr(line + n, '\n', r);
+    take = nl != NULL ? nl - (line + n) + 1 : r;
+    if ( how == Hseek && take < r )
+      lseek(fd, (off_t)take - r, SEEK_CUR);
+    else if ( how == Hpeek && read(fd, line + n, take) != take ) {
+      nl = NULL;		// someone else took it
+      r = -1;
+      break;
+    }
+    n += take;
+  }
+
+  if ( nl == NULL && (r < 0 || n == 0) ) {
+    if ( r == 0 )
+      errno = 0;
+    free(line);
+    return NULL;
+  }
+  if ( nl != NULL )
+    n--;
+  line[n] = '\0';
+  *len = n;
+  return line;
+} /*---------- End of inputLine ---------------------------------------------*/
+
+/*-----------------------------------------------------------------------------
+ *
+ * Name...........: peek
+ *
+ * Description....: reads what is in a pipe without taking it out.
+ * tee() waits for data, and copies what there is, up to len bytes, into
+ * Peek, which is then read.
+ *
+ * Input Param(s).: int fd -- the pipe
+ *		char *buf -- where to put the data
+ *		size_t len -- the most to put there
+ *
+ * Return Value(s): as read()
+ *
+ */
+
+static ssize_t peek(int fd, char *buf, size_t len)
+{
+  ssize_t n;
+
+  if ( Peek[0] < 0 ) {
+    if ( pipe2(Peek, O_CLOEXEC) < 0 )
+      return -1;
+    Peek[0] = eventHighFd(Peek[0]);
+    Peek[1] = eventHighFd(Peek[1]);
+  }
+  n = tee(fd, Peek[1], len, 0);
+  if ( n <= 0 )
+    return n;
+  return read(Peek[0], buf, n);	// all n are there
+} /*---------- End of peek ---------------------------------------------------*/
+
+/*........................ end of input.c ...................................*/
@@ -0,0 +1,17 @@
+/******************************************************************************
+ *
+ *  File Name........: input.h
+ *
+ *  Description......: header file for reading lines for the read builtin.
+ *
+ *****************************************************************************/
+
+#ifndef INPUT_H
+#define INPUT_H
+
+#include <stddef.h>
+
+char *inputLine(int, size_t *);
+
+#endif /* INPUT_H */
+/*........................ end of input.h ...................................*/
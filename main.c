@@ -16,104 +16,308 @@
  *
  *****************************************************************************/
 
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <linux/limits.h>
+#include <limits.h>
 #include <errno.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <sys/time.h>
+#include <time.h>
 #include <sys/resource.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+#include <sys/syscall.h>
+#include <sched.h>
 #include <ctype.h>
+#include <dlfcn.h>
 #include<signal.h>
 #include "parse.h"
+#include "expand.h"
+#include "event.h"
+#include "cgroup.h"
+#include "script.h"
+#include "var.h"
+#include "expr.h"
+#include "input.h"
+#include "memo.h"
+#include "builtin.h"
+
+struct saved_fd {
+		int fd, copy; // copy is -1 if fd was not open
+};
 
 void process_pipe(Pipe p);
+char *pipe_text(Pipe p);
+void join_pipe_pgrp(pid_t pid);
+int stage_failed(int status, int not_run);
+void tell_not_run();
+void read_not_run(int fd, pid_t *pids, int n, int *not_run);
 int process_cmd(Cmd c);
+int process_group(Cmd c);
+int source_file(char *name);
+void builtin_output(int on);
 
-void perform_io_redirect(Cmd c);
+int perform_io_redirect(Cmd c);
+int open_here(char *text, int add_newline);
 void perform_pipe_redirect(Cmd c);
+int save_fds(Cmd c, struct saved_fd **saved);
+void restore_fds(struct saved_fd *saved, int n);
+void apply_spawn_attr();
+int exec_args(char **args);
+Cmd sub_cmd(Cmd c, int first);
+int start_cmd(Cmd c);
+int run_cmd(Cmd c);
 
 int is_builtin(char *cmd_name);
-void exec_cd(Cmd c);
-void exec_echo(Cmd c);
-void exec_logout(Cmd c);
-void exec_nice(Cmd c);
-void exec_pwd(Cmd c);
-void exec_setenv(Cmd c);
-void exec_unsetenv(Cmd c);
-void exec_where(Cmd c);
+int exec_at(Cmd c);
+int exec_alias(Cmd c);
+int exec_batch(Cmd c);
+int exec_cd(Cmd c);
+int exec_echo(Cmd c);
+int exec_exec(Cmd c);
+int exec_limit(Cmd c);
+int exec_load(Cmd c);
+int exec_logout(Cmd c);
+int exec_memo(Cmd c);
+int exec_nice(Cmd c);
+int exec_printf(Cmd c);
+int exec_pwd(Cmd c);
+int exec_read(Cmd c);
+int exec_repeat(Cmd c);
+int exec_sched(Cmd c);
+int exec_set(Cmd c);
+int exec_setenv(Cmd c);
+int exec_source(Cmd c);
+int exec_test(Cmd c);
+int exec_timeout(Cmd c);
+int exec_unlimit(Cmd c);
+int exec_unalias(Cmd c);
+int exec_unset(Cmd c);
+int exec_unsetenv(Cmd c);
+int exec_where(Cmd c);
 
 int is_valid_cmd(char *path);
 int is_dir(char *path);
+int cached_stat(char *path, struct stat *st, int follow);
+void flush_stat_cache();
 int is_number(char* str);
+int printf_escape(FILE *out, char *s, int in_arg, int *stop);
+long long printf_integer(char *arg, int *status);
+int parse_cpus(char *str, cpu_set_t *cpus);
+int find_limit(char *name);
+int parse_limit(int k, char *str, rlim_t *value);
+void print_limit(int k, int hard);
+long duration_ms(char *str);
+int exit_status(int wstatus);
+int wait_slot(pid_t *pids, int n, int *wstatus);
+double elapsed_ms(struct timespec *since);
 
 struct builtin_cmd_handle_t {
 		char *cmd_name;
-		void (*exec_cmd) (Cmd c);
+		int (*exec_cmd) (Cmd c); // returns the exit status
 };
 
-struct builtin_cmd_handle_t builtin_cmd_handle[] = {
+struct builtin_cmd_handle_t builtin_cmds[] = {
+		{"@", exec_at},
+		{"[", exec_test},
+		{"alias", exec_alias},
+		{"batch", exec_batch},
 		{"cd", exec_cd},
 		{"echo", exec_echo},
+		{"exec", exec_exec},
+		{"limit", exec_limit},
+		{"load", exec_load},
 		{"logout", exec_logout},
+		{"memo", exec_memo},
 		{"nice", exec_nice},
+		{"printf", exec_printf},
 		{"pwd", exec_pwd},
+		{"read", exec_read},
+		{"repeat", exec_repeat},
+		{"sched", exec_sched},
+		{"set", exec_set},
 		{"setenv", exec_setenv},
+		{"source", exec_source},
+		{"test", exec_test},
+		{"timeout", exec_timeout},
+		{"unalias", exec_unalias},
+		{"unlimit", exec_unlimit},
+		{"unset", exec_unset},
 		{"unsetenv", exec_unsetenv},
 		{"where", exec_where}
 };
 
+/* The builtins: those above, then those of the shared objects loaded by load (see builtin.h), 
+   once there are some in a copy of the table that grows.
+ */
+struct builtin_cmd_handle_t *builtin_cmd_handle = builtin_cmds;
+int builtin_cmd_count = sizeof(builtin_cmds)/sizeof(builtin_cmds[0]);
+
+/* Attributes of the command started by nice or sched. 
+   They are set up in the child, between fork and exec, so that the shell itself is not affected.
+ */
+struct spawn_attr_t {
+		int set_nice, nice;
+		int set_cpus;
+		cpu_set_t cpus;
+		int set_policy, policy, prio;
+		int set_ioprio, ioprio;
+} spawn_attr;
+
+/* The output of builtins. stdout is unbuffered, so that prompts and messages of the shell appear at once, 
+   but while a builtin runs it is fully buffered: echo, printf or setenv write their output with one system call 
+   when they are done (or when BUILTIN_OUT_SIZE bytes are ready) instead of one per word. 
+   Builtins can run builtins (timeout echo x), only the outermost one switches buffering.
+ */
+#define BUILTIN_OUT_SIZE 65536
+char builtin_out[BUILTIN_OUT_SIZE];
+int builtin_depth = 0;
+
+/* Results of stat() and lstat() on the paths looked at by the current pipeline, errors included,
+   so that [ -e x -a ! -d x ] or the same test repeated costs one system call.
+   Emptied as each pipeline starts and by cd.
+ */
+#define STAT_CACHE_SIZE 16
+struct stat_cache_t {
+		char *path;
+		int follow; // stat() rather than lstat()
+		int error; // errno of the call, 0 if it succeeded
+		struct stat st;
+} stat_cache[STAT_CACHE_SIZE];
+int stat_cache_n = 0;
+
+/* The state of test while it parses its arguments.
+ */
+struct test_state_t {
+		char **args;
+		int pos, end; // the next argument, and the one after the last
+		int error; // set (message printed) on a syntax error or a bad number
+};
+int test_or(struct test_state_t *t);
+int test_and(struct test_state_t *t);
+int test_not(struct test_state_t *t);
+int test_primary(struct test_state_t *t);
+int test_unary(struct test_state_t *t, char op, char *arg);
+int test_binary(struct test_state_t *t, char *a, char *op, char *b);
+int test_integer(struct test_state_t *t, char *str, long long *value);
+
+/* The resources of limit and unlimit, and the unit of their values: 
+   seconds for cputime, kbytes for sizes, a plain number for the others.
+ */
+struct limit_t {
+		char *name;
+		int resource;
+		int scale; // bytes per unit, 0 for cputime
+} limits[] = {
+		{"cputime", RLIMIT_CPU, 0},
+		{"filesize", RLIMIT_FSIZE, 1024},
+		{"datasize", RLIMIT_DATA, 1024},
+		{"stacksize", RLIMIT_STACK, 1024},
+		{"coredumpsize", RLIMIT_CORE, 1024},
+		{"memoryuse", RLIMIT_RSS, 1024},
+		{"vmemoryuse", RLIMIT_AS, 1024},
+		{"memorylocked", RLIMIT_MEMLOCK, 1024},
+		{"descriptors", RLIMIT_NOFILE, 1},
+		{"maxproc", RLIMIT_NPROC, 1}
+};
+
 extern char **environ;
 int pipenum;
 int mypipes[2][2];
-int processing_rc = 0;
+int processing_rc = 0; // files being read by source (or ~/.ushrc), the end of one is not the end of the shell
+int last_status = 0; // exit status of the last pipeline (128+signal number if it was killed)
+pid_t shell_pid;
+int job_control = 0; // interactive shell on its terminal: pipelines get a process group and the terminal
+int pipe_pgrp = 0; // the pipeline being started gets a process group
+int pipe_fg = 0; // and the terminal
+pid_t pipe_pgid = 0; // its process group, 0 until its first process has been started
+int exit_after = 0; // the shell exits when the current list is done, so its last command can replace the shell
+int keep_fds = 0; // set by exec without a command: its redirections stay
+/* A stage of a pipeline that can't be executed writes its pid to this pipe (close-on-exec, 
+   so a stage that could be executed never holds it), which is how the shell tells that stage 
+   from one that ran and exited with 126 or 127 itself. -1 outside of a pipeline of several stages.
+ */
+int not_run_fd = -1;
 
-int main() {
+int main(int argc, char **argv) {
 		Pipe p; 
-		char hostname[64], *rcfile_name;
-		int saved_stdin;
+		char hostname[64], *rcfile_name, *text;
+		int fd;
+		FILE *script = NULL;
 
 		gethostname(hostname, sizeof(hostname));
 
-		signal(SIGINT, SIG_IGN); // Interrupt signal CTRL+C
+		/* ush -c string runs the commands of string, ush file those of file, 
+		   without prompting, and exits with the status of the last one.
+		 */
+		if(argc > 2 && strcmp(argv[1], "-c") == 0) {
+				text = malloc(strlen(argv[2]) + 2);
+				sprintf(text, "%s\n", argv[2]); // the parser wants lines
+				script = fmemopen(text, strlen(text), "r");
+				varSet("argv", &argv[3], argc - 3);
+		} else if(argc > 1) {
+				// kept above the descriptors the script may redirect (exec 3<data)
+				fd = open(argv[1], O_RDONLY);
+				if(fd == -1) {
+						perror(argv[1]);
+						exit(1);
+				}
+				script = fdopen(fcntl(fd, F_DUPFD_CLOEXEC, 10), "r");
+				close(fd);
+				varSet("argv", &argv[2], argc - 2);
+		}
+
 		signal(SIGQUIT, SIG_IGN); // Quit signal CTRL+'\'
 		//signal(SIGTSTP, SIG_IGN); // Stop signal /CTRL+Z
 
+		/* The interrupt signal (CTRL+C), SIGCHLD and SIGTERM are not handled asynchronously:
+		   the shell blocks them and reads them in its event loop, with the children it waits for.
+		 */
+		eventInit(script == NULL && isatty(0));
+
+		/* A shell that is in the foreground of its terminal puts each pipeline in a process group of its own, 
+		   which gets the terminal while it runs, so that CTRL+C reaches the pipeline only.
+		   The shell ignores SIGTTOU to take the terminal back.
+		 */
+		shell_pid = getpid();
+		if(script == NULL && isatty(0) && tcgetpgrp(0) == getpgrp()) {
+				job_control = 1;
+				signal(SIGTTOU, SIG_IGN);
+		}
+
 		/* When first stared, ush normally performs commands from the file ˜/.ushrc, 
 		   provided that it is readable. Commands in this file are processed just the same 
-		   as if they were taken from standard input.
+		   as if they were taken from standard input, as with source.
 		 */
 
 		rcfile_name = (char*)malloc(PATH_MAX);
-		strcat(rcfile_name, getenv("HOME"));
-		strcat(rcfile_name, "/.ushrc");
-		int rcfile = open(rcfile_name, O_RDONLY);
-		if (rcfile != -1) {
-				processing_rc = 1;
-				saved_stdin = dup(0);
-				dup2(rcfile, 0);
-				close(rcfile);
+		snprintf(rcfile_name, PATH_MAX, "%s/.ushrc", getenv("HOME") ? getenv("HOME") : "");
+		source_file(rcfile_name);
+		free(rcfile_name);
+		setbuf(stdout, NULL);
+		setbuf(stdin, NULL);
+		setbuf(stderr, NULL);
 
+		/* A script is read ahead at the end of each line, 
+		   so that if the line is the last one, its last command can be executed in place of the shell
+		   instead of the shell forking and waiting for it.
+		 */
+		if(script != NULL) {
+				parseInput(script);
 				while(1) {
 						p = parse();
-						if(strcmp(p->head->args[0], "end") == 0) {
-								freePipe(p);
-								break;
-						}
-						process_pipe(p);
-						freePipe(p);
+						exit_after = parseEnd();
+						scriptLine(p, NULL);
+						expandFlush();
 				}
-				processing_rc = 0;
-				dup2(saved_stdin, 0);
-				close(saved_stdin);
 		}
-		setbuf(stdout, NULL);
-		setbuf(stdin, NULL);
-		setbuf(stderr, NULL);
 
 		/* After startup processing, an interactive ush shell begins reading commands 
 		   from the terminal, prompting with hostname%. 
@@ -123,14 +327,20 @@ int main() {
 		   and the shell executes each command in the current line.
 		 */
 		while (1) {
+				eventNotify(); // tell about background jobs that are done
+
 				//if (isatty(STDIN_FILENO)) { // print the prompt if stdin is associated with a terminal
 				printf("%s%% ", hostname);
 				//fflush(NULL);
 				//}
 
+				if(eventInput(0) == -1) { // CTRL+C at the prompt
+						printf("\n");
+						continue;
+				}
 				p = parse();
-				process_pipe(p);
-				freePipe(p);
+				scriptLine(p, "? "); // if, while and foreach prompt for the rest of their block
+				expandFlush();
 		}
 }
 
@@ -232,19 +442,76 @@ int main() {
 		void process_pipe(Pipe p) {
 
 				Cmd c;
-				int ret = 0, wpid, child_status, no_of_child=0;
+				int ret = 0, child_status, no_of_child=0, background = 0, i, status, *statuses, left, aborted = 0;
+				int saved_pgrp, saved_fg, own_pgrp, own_cgroup, *not_run, not_run_pipe[2] = {-1, -1}, saved_not_run_fd;
+				pid_t *child_pids, last_pid = 0, pid, saved_pgid;
+				Token conn;
 				pipenum = 0;
 				mypipes[0][0] = mypipes[0][1] = mypipes[1][0] = mypipes[1][1] = -1;
 
 				if(p == NULL) 
 						return;
+				flush_stat_cache();
 
 				//printf("Begin pipe%s\n", p->type == Pout ? "" : " Error");
 
+				/* Expand the words of every command (globbing, quote removal) before starting any of them,
+				   so that a pattern without a match aborts the pipeline before anything runs.
+				 */
+				for(c = p->head; c != NULL; c = c->next) {
+						if(expandCmd(c) < 0) {
+								expandReap();
+								last_status = 1;
+								goto next_pipe;
+						}
+						no_of_child++;
+						if(c->next == NULL && c->exec == Tamp)
+								background = 1;
+				}
+
+				/* The last command of a script (or of a subshell) that is an external command by itself 
+				   replaces the shell: its status is the shell's anyway.
+				   Not in cgroup mode, which reports on the command once it is done.
+				 */
+				c = p->head;
+				if(exit_after && p->next == NULL && c->next == NULL && c->sub == NULL && !background 
+								&& is_builtin(c->args[0]) == -1 && !scriptFunction(c->args[0]) && !IsEnd(c) && getenv("cgroup") == NULL) {
+						if(perform_io_redirect(c) == -1)
+								exit(1);
+						exit(exec_args(c->args));
+				}
+				child_pids = malloc(no_of_child * sizeof(pid_t));
+				statuses = calloc(no_of_child, sizeof(int));
+				not_run = calloc(no_of_child, sizeof(int));
+
+				// only a pipeline of several stages has others to abort
+				saved_not_run_fd = not_run_fd;
+				if(no_of_child > 1 && pipe2(not_run_pipe, O_CLOEXEC | O_NONBLOCK) == 0) {
+						not_run_pipe[0] = eventHighFd(not_run_pipe[0]);
+						not_run_pipe[1] = eventHighFd(not_run_pipe[1]);
+						not_run_fd = not_run_pipe[1];
+				}
+				no_of_child = 0;
+
+				/* A pipeline of the interactive shell starts a process group, 
+				   one that a pipeline (a { } group) is part of runs in the process group of that pipeline.
+				 */
+				saved_pgrp = pipe_pgrp;
+				saved_fg = pipe_fg;
+				saved_pgid = pipe_pgid;
+				own_pgrp = 0;
+				if(pipe_pgid == 0) {
+						pipe_pgrp = own_pgrp = job_control && getpid() == shell_pid;
+						pipe_fg = !background;
+				}
+
+				// with setenv cgroup, a foreground pipeline that starts processes runs in a cgroup of its own
+				own_cgroup = !background && (p->head->next != NULL || p->head->sub != NULL || is_builtin(p->head->args[0]) == -1)
+						&& cgroupStart() == 0;
+
 				mypipes[pipenum][0] = 0;
 
 				for(c = p->head; c != NULL; c = c->next) {
-						no_of_child ++;
 						//printf("next cmd:%s\n", c->args[0]);
 
 						pipenum = !pipenum;
@@ -268,9 +535,16 @@ int main() {
 						ret = process_cmd(c);
 						if(ret < 0)
 								break;
+						if(ret > 0) // built-ins run by the shell itself have nothing to wait for
+								child_pids[no_of_child++] = ret;
+						if(c->next == NULL) // the status of a pipeline is that of its last command
+								last_pid = ret;
 
 				}
 				//printf("all commands started\n");
+				if(not_run_pipe[1] != -1)
+						close(not_run_pipe[1]);
+				not_run_fd = saved_not_run_fd;
 
 				// close all newly created FDs after every pipeline, so that we don't have unused open files
 				if(mypipes[0][0] != 0)
@@ -282,22 +556,165 @@ int main() {
 				if(mypipes[1][1] != 1)
 						close(mypipes[1][1]);
 
-				while(no_of_child--) {
-						wpid = wait(child_status);
+				if(background) { // the shell goes on, the event loop reaps the job later
+						eventJob(child_pids, no_of_child, pipe_text(p));
+						no_of_child = 0;
+						last_status = 0;
+				}
+
+				// the children are reaped in the order they exit
+				left = no_of_child;
+				while(left > 0 && (pid = eventWait(child_pids, no_of_child, &child_status, -1)) > 0) {
 						//printf("waiting for all children to terminate\n");
+						left--;
+						status = exit_status(child_status);
+						for(i = 0; child_pids[i] != pid; i++)
+								;
+						statuses[i] = status;
+						if(pid == last_pid)
+								last_status = status;
+						if(status == 127 || status == 126)
+								read_not_run(not_run_pipe[0], child_pids, no_of_child, not_run);
 
 						/* If an error occurs with any component of a pipeline the entire pipeline is aborted, 
 						   even though some of the pipeline may already be executing.
+						   The stages still running are terminated at once: all of the process group if the
+						   pipeline has one of its own, else each of them through its pidfd.
 						 */
-						if (WEXITSTATUS(child_status) == -1) {
-								printf("command failed, aborting entire pipeline\n");
-								kill(-0, SIGQUIT);
+						if(left > 0 && !aborted && stage_failed(status, not_run[i])) {
+								if(not_run[i]) // with pipefail a failure is nothing to tell about
+										printf("command failed, aborting entire pipeline\n");
+								aborted = 1;
+								if(own_pgrp && pipe_pgid > 0)
+										killpg(pipe_pgid, SIGTERM);
+								else
+										eventKill(child_pids, no_of_child, SIGTERM);
 						}
 				}
 
+				/* With pipefail set, the status of the pipeline is that of its last command that failed, 
+				   the stages killed by an abort not counting.
+				 */
+				if(getenv("pipefail") != NULL)
+						for(i = 0; i < no_of_child; i++)
+								if(stage_failed(statuses[i], not_run[i]))
+										last_status = statuses[i];
+				free(child_pids);
+				free(statuses);
+				free(not_run);
+				if(not_run_pipe[0] != -1)
+						close(not_run_pipe[0]);
+
+				if(own_cgroup)
+						cgroupEnd(); // tells what the pipeline used
+				if(own_pgrp && pipe_fg)
+						tcsetpgrp(0, getpgrp()); // the shell takes the terminal back
+				pipe_pgrp = saved_pgrp;
+				pipe_fg = saved_fg;
+				pipe_pgid = saved_pgid;
+
+				// processes started for <(cmd) and >(cmd) arguments
+				expandReap();
+
 				//printf("End pipe\n"); 
-				process_pipe(p->next);
+
+		next_pipe:
+				/* With && the next pipeline runs only if this one succeeded, with || only if it failed.
+				   A pipeline that is skipped hands the same status on to the connector that follows it,
+				   so false && a || b runs b.
+				 */
+				conn = p->conn;
+				for(p = p->next; p != NULL; p = p->next) {
+						if((conn == Tand && last_status == 0) || (conn == Tor && last_status != 0) || conn == Tsemi)
+								break;
+						conn = p->conn;
+				}
+				process_pipe(p);
+		}
+
+
+/* Returns the text of a pipeline, as told when a background job is done (on the heap).
+ */
+char *pipe_text(Pipe p) {
+		Cmd c;
+		char *text;
+		int i, len = 1;
+
+		for(c = p->head; c != NULL; c = c->next)
+				for(i = 0; i < c->nargs; i++)
+						len += strlen(c->args[i]) + 4;
+		text = malloc(len);
+		if(text == NULL) {
+				perror("malloc");
+				exit(errno);
+		}
+		text[0] = '\0';
+		for(c = p->head; c != NULL; c = c->next) {
+				for(i = 0; i < c->nargs; i++) {
+						strcat(text, c->args[i]);
+						if(i < c->nargs - 1)
+								strcat(text, " ");
+				}
+				if(c->next != NULL)
+						strcat(text, p->type == Pout ? " | " : " |& ");
 		}
+		return text;
+}
+
+
+/* Puts a process of the pipeline being started into the pipeline's process group, the first one starts it.
+   Called in both the child (with pid 0) and the shell, as either could run first after fork.
+   A foreground pipeline gets the terminal.
+ */
+void join_pipe_pgrp(pid_t pid) {
+		if(!pipe_pgrp)
+				return;
+		if(pid == 0)
+				pid = getpid();
+		if(pipe_pgid == 0)
+				pipe_pgid = pid;
+		setpgid(pid, pipe_pgid);
+		if(pipe_fg)
+				tcsetpgrp(0, pipe_pgid);
+}
+
+
+/* Whether a stage of a pipeline failed, which aborts the rest of the pipeline:
+   one that could not be run at all (not_run, see not_run_fd) always, 
+   with pipefail set (setenv pipefail) any that failed, except by SIGPIPE or the SIGTERM of an abort.
+ */
+int stage_failed(int status, int not_run) {
+		if(not_run)
+				return 1;
+		return getenv("pipefail") != NULL && status != 0 && status != 128 + SIGPIPE && status != 128 + SIGTERM;
+}
+
+
+/* Called in a stage that is about to exit because its command can't be executed: 
+   tells the shell so through not_run_fd.
+ */
+void tell_not_run() {
+		pid_t pid = getpid();
+
+		if(not_run_fd != -1)
+				write(not_run_fd, &pid, sizeof(pid)); // less than PIPE_BUF, so in one piece
+}
+
+
+/* Reads the pids of the stages that could not be executed from the pipe of not_run_fd, 
+   and marks those of the n in pids in not_run.
+ */
+void read_not_run(int fd, pid_t *pids, int n, int *not_run) {
+		pid_t pid;
+		int i;
+
+		if(fd == -1)
+				return;
+		while(read(fd, &pid, sizeof(pid)) == sizeof(pid))
+				for(i = 0; i < n; i++)
+						if(pids[i] == pid)
+								not_run[i] = 1;
+}
 
 
 /* If the command is an ush shell built-in, the shell executes it directly. 
@@ -311,55 +728,77 @@ int main() {
    the shell forks a new process to run the command. 
    The shell also passes along any arguments to the command. 
    If successful, the shell is silent.
+
+   Returns the pid of the process started for the command, 
+   0 if the shell ran it itself, or -1 if it couldn't be started.
  */
 int process_cmd(Cmd c) {
 		pid_t child_pid;
-		int i, saved_stdin, saved_stdout;
+		struct saved_fd *saved;
+		int i, nsaved, func;
 
-		if(strcmp(c->args[0], "end") == 0 && processing_rc == 0)
-				exit(0);
+		if(c->sub != NULL) // ( ) or { } group
+				return process_group(c);
+
+		if(IsEnd(c) && processing_rc == 0)
+				exit(last_status);
 
 		i = is_builtin(c->args[0]);
+		func = i == -1 && scriptFunction(c->args[0]);
 
-		if(i != -1) { // shell built-in command 
+		if(i != -1 || func) { // shell built-in command or function
 
 				//printf("built in cmd\n");
 
-				if (c->next == NULL) { //last command in a pipe, execute built-in in current shell
+				if (c->next == NULL && c->exec != Tamp) { //last command in a pipe, execute built-in in current shell
 
-						/* Save standard input and output before redirecting, 
+						/* Save the descriptors before redirecting, 
 						   as we are not executing inside a new process, but inside the shell process.
 						 */
-						saved_stdin = dup(0);
-						saved_stdout = dup(1);
+						nsaved = save_fds(c, &saved);
 
 						perform_pipe_redirect(c);
-						perform_io_redirect(c);
-						builtin_cmd_handle[i].exec_cmd(c);
-
-						// Restore standard input and output
-						dup2(saved_stdin, 0);
-						dup2(saved_stdout, 1);
-						close(saved_stdin);
-						close(saved_stdout);
+						if(perform_io_redirect(c) == 0) {
+								builtin_output(1);
+								last_status = func ? scriptCall(c) : builtin_cmd_handle[i].exec_cmd(c);
+								builtin_output(0);
+						} else
+								last_status = 1;
+
+						if(keep_fds) { // exec 3>file
+								for(i = 0; i < nsaved; i++)
+										if(saved[i].copy != -1)
+												close(saved[i].copy);
+								free(saved);
+								keep_fds = 0;
+						} else
+								restore_fds(saved, nsaved);
+						return 0;
 
 				} else { //command in pipeline, execute built-in in a subshell
 
-						child_pid = fork();
+						child_pid = cgroupFork();
 
 						if(child_pid == 0) { //child process executing 
 								//printf("%s executing after fork\n", c->args[0]);
+								join_pipe_pgrp(0);
+								eventFork();
+								apply_spawn_attr();
 								signal(SIGINT, SIG_DFL);
 								signal(SIGQUIT, SIG_DFL);
 								signal(SIGTSTP, SIG_DFL);
+								signal(SIGTTOU, SIG_DFL);
+								eventUnblock(); // else a builtin loop would never see CTRL+C
 
 								perform_pipe_redirect(c);
-								perform_io_redirect(c); /* do we need IO redirection in the middle of a pipeline?
-														   BASH supports commands like: echo 'hello' > out.txt | wc
-														   though it doesn't make sense, as the output is 0 0 0.
-														 */
-								builtin_cmd_handle[i].exec_cmd(c);
-								exit(0);
+								/* do we need IO redirection in the middle of a pipeline?
+								   BASH supports commands like: echo 'hello' > out.txt | wc
+								   though it doesn't make sense, as the output is 0 0 0.
+								 */
+								if(perform_io_redirect(c) == -1)
+										exit(1);
+								builtin_output(1); // exit() writes it
+								exit(func ? scriptCall(c) : builtin_cmd_handle[i].exec_cmd(c));
 						} else {
 								//printf("shell executing after fork for %s\n", c->args[0]);
 						}
@@ -367,94 +806,353 @@ int process_cmd(Cmd c) {
 
 		} else { // user-defined executable
 
-				child_pid = fork();
+				child_pid = cgroupFork();
 
 				if(child_pid == 0) { //child process executing
 						//printf("%s executing after fork\n", c->args[0]);
-						signal(SIGINT, SIG_DFL);
-						signal(SIGQUIT, SIG_DFL);
-						signal(SIGTSTP, SIG_DFL);
+						join_pipe_pgrp(0);
+						eventFork();
 
 						perform_pipe_redirect(c);
-						perform_io_redirect(c);
-
-						execvp(c->args[0], c->args);
-
-						//If execvp returns, it must have failed.
-
-						switch(errno) {			
-								case EACCES: 
-										printf("permission denied\n"); 
-										break;
-								case ENOENT: 
-										printf("command not found\n"); 
-						}
+						if(perform_io_redirect(c) == -1)
+								exit(1);
 
-						exit(-1);
+						exit(exec_args(c->args));
 				} else {
 						//printf("shell executing after fork for %s\n", c->args[0]);
 				}
 		}
 
+		if(child_pid == -1)
+				perror("fork");
+		else if(child_pid > 0) {
+				join_pipe_pgrp(child_pid);
+				eventWatch(child_pid);
+		}
+		return child_pid;
+}
+
+
+/* Switches stdout to the buffer of builtin output as a builtin starts (on is 1), 
+   and writes what is in it and switches back as it ends (on is 0).
+ */
+void builtin_output(int on) {
+		fflush(stdout);
+		if(on && builtin_depth++ == 0)
+				setvbuf(stdout, builtin_out, _IOFBF, sizeof(builtin_out));
+		else if(!on && --builtin_depth == 0)
+				setvbuf(stdout, NULL, _IONBF, 0);
+}
+
+
+/* Runs the commands of a file in the shell, for source and ~/.ushrc. 
+   The parser reads the file itself, fd 0 is left alone, so the commands have the shell's standard input.
+   The last command is not executed in place of the shell even in a script, as more may follow the source.
+   Returns 0, or -1 (errno is set) if the file can't be read.
+ */
+int source_file(char *name) {
+		FILE *f;
+		Pipe p;
+		int fd, saved_exit_after;
+
+		fd = open(name, O_RDONLY | O_CLOEXEC);
+		if(fd == -1)
+				return -1;
+		fd = eventHighFd(fd); // kept above the descriptors the file may redirect
+		f = fdopen(fd, "r");
+		if(f == NULL) {
+				close(fd);
+				return -1;
+		}
+		if(parsePush(f) < 0) {
+				fclose(f);
+				errno = ELOOP;
+				return -1;
+		}
+
+		processing_rc++;
+		saved_exit_after = exit_after;
+		exit_after = 0;
+		while(1) {
+				p = parse();
+				if(p != NULL && IsEnd(p->head)) {
+						freePipe(p);
+						break;
+				}
+				scriptLine(p, NULL);
+				expandFlush();
+		}
+		exit_after = saved_exit_after;
+		processing_rc--;
+		fclose(parsePop());
 		return 0;
 }
 
 
-void perform_io_redirect(Cmd c) { 
+/* Executes a command in place of the current process: the child of the shell for the command, 
+   or the shell itself for exec and the last command of a script.
+   The signal handling of the shell is undone first.
+   Returns only if the command couldn't be executed, with the status to exit with: 
+   127 if it was not found, else 126.
+ */
+int exec_args(char **args) {
+		int err;
+
+		fflush(stdout); // what exec x; echo y or a builtin before has written
+		eventExec();
+		apply_spawn_attr();
+		signal(SIGINT, SIG_DFL);
+		signal(SIGQUIT, SIG_DFL);
+		signal(SIGTSTP, SIG_DFL);
+		signal(SIGTTOU, SIG_DFL);
+
+		execvp(args[0], args);
+
+		//If execvp returns, it must have failed.
+		err = errno; // before printf() can change it
+
+		switch(err) {			
+				case EACCES: 
+						printf("permission denied\n"); 
+						break;
+				case ENOENT: 
+						printf("command not found\n"); 
+						break;
+				case E2BIG: 
+						printf("argument list too long\n"); 
+		}
+		tell_not_run();
+		return err == ENOENT ? 127 : 126;
+}
+
+
+/* ( list ) runs the list in a subshell: the shell forks once, and the child runs the list.
+   { list } runs the list in the current shell, so that e.g. cd affects the shell;
+   only when it is not the last command of a pipeline it needs a process of its own.
+   Either way, the redirections of the group are performed once for all of its commands,
+   so { a; b; c; } > log opens log once instead of once per command.
 
-		//printf("redirecting for %s\n", c->args[0]);
+   Returns like process_cmd().
+ */
+int process_group(Cmd c) {
+		pid_t child_pid;
+		struct saved_fd *saved;
+		int saved_pipes[2][2], saved_pipenum, nsaved, saved_exit_after;
+
+		if(c->args[0][0] == '{' && c->next == NULL && c->exec != Tamp) {
+				// the list is a pipeline sequence of its own, which uses mypipes too
+				saved_pipenum = pipenum;
+				memcpy(saved_pipes, mypipes, sizeof(mypipes));
+				nsaved = save_fds(c, &saved);
+				saved_exit_after = exit_after; // the shell has more to do after the group
+				exit_after = 0;
+
+				perform_pipe_redirect(c);
+				if(perform_io_redirect(c) == 0)
+						process_pipe(c->sub);
+				else
+						last_status = 1;
+				exit_after = saved_exit_after;
+
+				fflush(stdout);
+				restore_fds(saved, nsaved);
+				// perform_pipe_redirect() has closed these already
+				saved_pipes[!saved_pipenum][1] = saved_pipes[saved_pipenum][0] = -1;
+				memcpy(mypipes, saved_pipes, sizeof(mypipes));
+				pipenum = saved_pipenum;
+				return 0;
+		}
 
-		int input, output;
-		if(c->in == Tin) {
-				//printf("<(%s) ", c->infile);
-				input = open(c->infile, O_RDONLY);
-				if(input != -1) {
-						dup2(input, 0);
-						close(input);
-				} else
-						exit(-1);
+		child_pid = cgroupFork();
+		if(child_pid == 0) { // the subshell keeps the shell's signal handling, its commands reset it
+				join_pipe_pgrp(0);
+				eventFork();
+				perform_pipe_redirect(c);
+				if(perform_io_redirect(c) == -1)
+						exit(1);
+				exit_after = 1;
+				process_pipe(c->sub);
+				exit(last_status);
 		}
-		if(c->out != Tnil)
-				switch (c->out) {
-						case Tout:
-								//printf(">(%s) ", c->outfile);
-								output = open(c->outfile, O_WRONLY | O_CREAT | O_TRUNC,
-												S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
-								if(output != -1) {
-										dup2(output, 1);
-										close(output);
-								}
+		if(child_pid == -1)
+				perror("fork");
+		else {
+				join_pipe_pgrp(child_pid);
+				eventWatch(child_pid);
+		}
+		return child_pid;
+}
+
+
+/* Performs the redirections of a command in the order they were given, 
+   so >log 2>&1 sends both output and errors to log, while 2>&1 >log sends errors where the output went before.
+   n<file, n>file and n>>file redirect descriptor n (0 for <, 1 for >), 
+   n>&m (or n<&m) makes n a copy of m, and n>&- closes n.
+
+   Returns 0, or -1 if a file couldn't be opened or a descriptor to copy is not open; 
+   the redirections before the failing one stay done.
+ */
+int perform_io_redirect(Cmd c) { 
+
+		//printf("redirecting for %s\n", c->args[0]);
+
+		Redir r;
+		int fd;
+
+		for(r = c->redir; r != NULL; r = r->next) {
+				switch(r->type) {
+						case Tin:
+								fd = open(r->file, O_RDONLY);
 								break;
-						case Tapp:
-								//printf(">>(%s) ", c->outfile);
-								output = open(c->outfile, O_RDWR | O_CREAT | O_APPEND,
-												S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
-								if(output != -1) {
-										dup2(output, 1);
-										close(output);
-								}
+						case Theredoc:
+						case Therestr:
+								fd = open_here(r->file, r->type == Therestr);
+								if(fd == -1)
+										return -1; // open_here() has told why
 								break;
+						case Tout:
 						case ToutErr:
-								//printf(">&(%s) ", c->outfile);
-								output = open(c->outfile, O_WRONLY | O_CREAT | O_TRUNC,
+								fd = open(r->file, O_WRONLY | O_CREAT | O_TRUNC,
 												S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
-								if(output != -1) {
-										dup2(output, 1);
-										dup2(output, 2);
-										close(output);
-								}
 								break;
+						case Tapp:
 						case TappErr:
-								//printf(">>&(%s) ", c->outfile);
-								output = open(c->outfile, O_RDWR | O_CREAT | O_APPEND,
+								fd = open(r->file, O_RDWR | O_CREAT | O_APPEND,
 												S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
-								if(output != -1) {
-										dup2(output, 1);
-										dup2(output, 2);
-										close(output);
-								}
 								break;
+						case Tdup:
+								if(r->dupfd == -1)
+										close(r->fd);
+								else if(dup2(r->dupfd, r->fd) == -1) {
+										fprintf(stderr, "%d: %s.\n", r->dupfd, strerror(errno));
+										return -1;
+								}
+								continue;
+						default:
+								continue;
+				}
+				if(fd == -1) {
+						fprintf(stderr, "%s: %s.\n", r->file, strerror(errno));
+						return -1;
+				}
+				if(fd != r->fd) {
+						dup2(fd, r->fd);
+						close(fd);
+				}
+				if(r->type == ToutErr || r->type == TappErr)
+						dup2(r->fd, 2);
+		}
+		return 0;
+}
+
+
+/* Before the shell redirects its own descriptors (for a built-in or a { } group it runs itself), 
+   saves a copy of each one that can change: 0, 1, 2 and any other the redirections of the command name.
+   The copies are made above all of those, so that a redirection can't overwrite one.
+
+   Returns the number of descriptors saved in *saved, to be handed to restore_fds().
+ */
+int save_fds(Cmd c, struct saved_fd **saved) {
+		Redir r;
+		int i, n, max, base;
+
+		max = 3;
+		base = 10;
+		for(r = c->redir; r != NULL; r = r->next) {
+				max++;
+				if(r->fd >= base)
+						base = r->fd + 1;
+		}
+		*saved = malloc(max * sizeof(**saved));
+		if(*saved == NULL) {
+				perror("malloc");
+				exit(errno);
+		}
+
+		n = 0;
+		for(i = 0; i < 3; i++)
+				(*saved)[n++].fd = i;
+		for(r = c->redir; r != NULL; r = r->next) {
+				for(i = 0; i < n && (*saved)[i].fd != r->fd; i++)
+						;
+				if(i == n)
+						(*saved)[n++].fd = r->fd;
+		}
+		for(i = 0; i < n; i++)
+				(*saved)[i].copy = fcntl((*saved)[i].fd, F_DUPFD_CLOEXEC, base);
+		return n;
+}
+
+
+// Puts back the descriptors saved by save_fds(), and closes those that were not open before.
+void restore_fds(struct saved_fd *saved, int n) {
+		int i;
+
+		for(i = 0; i < n; i++) {
+				if(saved[i].copy == -1)
+						close(saved[i].fd);
+				else {
+						dup2(saved[i].copy, saved[i].fd);
+						close(saved[i].copy);
+				}
+		}
+		free(saved);
+}
+
+
+/* Returns a descriptor to read the text of a here document (<<word) or here string (<<<word) from.
+   No file is involved: a text that fits in a pipe (PIPE_BUF bytes, which are written atomically and
+   cannot block on an empty pipe) is written to one, anything larger goes to an anonymous memfd.
+   A here string gets a newline appended.
+ */
+int open_here(char *text, int add_newline) {
+		struct iovec iov[2];
+		int fds[2], fd, n;
+		ssize_t len, ret;
+
+		iov[0].iov_base = text;
+		iov[0].iov_len = strlen(text);
+		iov[1].iov_base = "\n";
+		iov[1].iov_len = 1;
+		n = add_newline ? 2 : 1;
+		len = iov[0].iov_len + (add_newline ? 1 : 0);
+
+		if(len <= PIPE_BUF) {
+				if(pipe(fds) == -1) {
+						perror("pipe");
+						return -1;
+				}
+				writev(fds[1], iov, n);
+				close(fds[1]);
+				return fds[0];
+		}
+
+		fd = memfd_create("ush-here", MFD_CLOEXEC);
+		if(fd == -1) {
+				perror("memfd_create");
+				return -1;
+		}
+		while(len > 0) {
+				ret = writev(fd, iov, n);
+				if(ret == -1) {
+						perror("write");
+						close(fd);
+						return -1;
+				}
+				len -= ret;
+				// a short write on a memfd only happens when memory is short, move past what got written
+				while(n > 0 && ret >= (ssize_t)iov[0].iov_len) {
+						ret -= iov[0].iov_len;
+						iov[0] = iov[1];
+						n--;
 				}
+				if(n > 0) {
+						iov[0].iov_base = (char *)iov[0].iov_base + ret;
+						iov[0].iov_len -= ret;
+				}
+		}
+		lseek(fd, 0, SEEK_SET);
+		return fd;
 }
 
 
@@ -475,12 +1173,12 @@ void perform_pipe_redirect(Cmd c) {
 
 
 int is_builtin(char *cmd_name) {
-		int i = 0, len = sizeof(builtin_cmd_handle)/sizeof(builtin_cmd_handle[0]);
+		int i = 0;
 
 		if(!cmd_name)
-				return;
+				return -1;
 
-		while (i < len) {
+		while (i < builtin_cmd_count) {
 				if(strcmp(builtin_cmd_handle[i].cmd_name, cmd_name) == 0)
 						return i;
 				i++;
@@ -489,19 +1187,204 @@ int is_builtin(char *cmd_name) {
 }
 
 
+/* format: @ [VAR = expr | VAR op= expr | VAR++ | VAR--]
+   Without arguments, prints the names and values of all shell variables.
+   Sets the shell variable VAR to the value of expr, computed by the shell itself over 64-bit integers;
+   op= is one of += -= *= /= %= and applies op to the number VAR holds.
+   The operators are those of if and while (see expr.c). An expr with < > & or | must be in parentheses.
+ */
+int exec_at(Cmd c) {
+		char *name, *op, opc[2], buf[32], *word = buf, **old;
+		long long v, n;
+		int len, nold, status = 1;
+
+		if(c->nargs == 1) {
+				varList();
+				return 0;
+		}
+		len = strlen(c->args[1]);
+		if(c->nargs == 2 && len > 2 && c->args[1][len - 1] == c->args[1][len - 2]
+		   && (c->args[1][len - 1] == '+' || c->args[1][len - 1] == '-')) { // @ VAR++
+				name = strndup(c->args[1], len - 2);
+				op = c->args[1][len - 1] == '+' ? "+=" : "-=";
+				v = 1;
+		} else if(c->nargs > 3 && (strcmp(c->args[2], "=") == 0
+		   || (strlen(c->args[2]) == 2 && c->args[2][1] == '=' && strchr("+-*/%", c->args[2][0]) != NULL))) {
+				name = strdup(c->args[1]);
+				op = c->args[2];
+				if(exprEval(&c->args[3], c->nargs - 3, &v) < 0) {
+						free(name);
+						return 1;
+				}
+		} else {
+				printf("@: Syntax Error.\n");
+				return 1;
+		}
+
+		if(!varName(name)) {
+				printf("@: Variable name must begin with a letter.\n");
+				goto out;
+		}
+		if(op[1] == '=') { // VAR op= expr
+				old = varGet(name, &nold);
+				if(old == NULL) {
+						printf("%s: Undefined variable.\n", name);
+						goto out;
+				}
+				opc[0] = op[0];
+				opc[1] = '\0';
+				if(exprNumber(nold == 1 ? old[0] : nold ? "-" : "", &n) < 0 || exprOp(opc, n, v, &v) < 0)
+						goto out;
+		}
+		snprintf(buf, sizeof(buf), "%lld", v);
+		varSet(name, &word, 1);
+		status = 0;
+ out:
+		free(name);
+		return status;
+}
+
+
+/* format: alias [name [wordlist]]
+   Without arguments, prints all aliases; with name, prints its alias; 
+   with name and wordlist, makes wordlist the alias of name.
+   The first word of a command is replaced by its alias when the line is parsed.
+ */
+int exec_alias(Cmd c) {
+		if(c->nargs == 1) {
+				aliasList(NULL);
+				return 0;
+		}
+		if(c->nargs == 2) {
+				aliasList(c->args[1]);
+				return 0;
+		}
+		if(strcmp(c->args[1], "alias") == 0 || strcmp(c->args[1], "unalias") == 0) {
+				printf("%s: Too dangerous to alias that.\n", c->args[1]);
+				return 1;
+		}
+		aliasSet(c->args[1], &c->args[2], c->nargs - 2);
+		return 0;
+}
+
+
+/* format: batch [-j jobs] command [options] [args]
+   Runs command with args, but if they are more than one exec takes (ARG_MAX, the environment included), 
+   as many times as needed, each time with as many of the args as fit, like xargs without the extra process.
+   The command and its options (its words starting with -, up to --) are repeated in each batch.
+   With -j, up to jobs batches run at a time. A batch killed by a signal stops the others from starting.
+   The status is 0 if all batches succeeded, else that of the last one that failed.
+ */
+int exec_batch(Cmd c) {
+		extern char **environ;
+		char **args, **e;
+		size_t base, size, len;
+		long max;
+		int first = 1, jobs = 1, fixed, i, n, running = 0, status = 0, wstatus;
+		pid_t *pids, pid;
+		Cmd temp;
+
+		if(c->nargs > 2 && strcmp(c->args[1], "-j") == 0) {
+				jobs = is_number(c->args[2]) ? atoi(c->args[2]) : 0;
+				first = 3;
+		}
+		if(c->nargs <= first || jobs < 1) {
+				fprintf(stderr, "Usage: batch [-j jobs] command.\n");
+				return 1;
+		}
+		// builtins and functions take any number of words
+		if(is_builtin(c->args[first]) != -1 || scriptFunction(c->args[first]))
+				return run_cmd(sub_cmd(c, first));
+
+		max = sysconf(_SC_ARG_MAX);
+		if(max <= 0)
+				max = ARG_MAX;
+		max -= 2048; // headroom, as POSIX asks of xargs
+
+		/* What execve() copies: each string with its '\0' and a pointer to it, 
+		   and the NULL ending argv and envp.
+		 */
+		base = 2 * sizeof(char *);
+		for(e = environ; *e != NULL; e++)
+				base += strlen(*e) + 1 + sizeof(char *);
+		for(fixed = first + 1; fixed < c->nargs && c->args[fixed][0] == '-'; fixed++)
+				if(strcmp(c->args[fixed], "--") == 0) {
+						fixed++;
+						break;
+				}
+		for(i = first; i < fixed; i++)
+				base += strlen(c->args[i]) + 1 + sizeof(char *);
+
+		args = malloc((c->nargs + 1) * sizeof(char *));
+		pids = malloc(jobs * sizeof(pid_t));
+		if(args == NULL || pids == NULL) {
+				perror("malloc");
+				exit(errno);
+		}
+		memcpy(args, &c->args[first], (fixed - first) * sizeof(char *));
+
+		i = fixed;
+		do {
+				if(running == jobs) {
+						n = wait_slot(pids, running, &wstatus);
+						pids[n] = pids[--running];
+						if(exit_status(wstatus) != 0)
+								status = exit_status(wstatus);
+						if(WIFSIGNALED(wstatus))
+								break;
+				}
+
+				n = fixed - first;
+				size = base;
+				while(i < c->nargs) {
+						len = strlen(c->args[i]) + 1 + sizeof(char *);
+						if(size + len > (size_t)max && n > fixed - first) // an arg too long for any batch goes alone, and fails
+								break;
+						size += len;
+						args[n++] = c->args[i++];
+				}
+				args[n] = NULL;
+
+				/* The batch is a command of its own, its args the shell's until the fork, 
+				   so the next batch can reuse them.
+				 */
+				temp = sub_cmd(c, first);
+				temp->args = args;
+				temp->nargs = n;
+				pid = start_cmd(temp);
+				free(temp);
+				if(pid > 0)
+						pids[running++] = pid;
+				else
+						status = 1;
+		} while(i < c->nargs);
+
+		while(running > 0) {
+				n = wait_slot(pids, running, &wstatus);
+				pids[n] = pids[--running];
+				if(exit_status(wstatus) != 0)
+						status = exit_status(wstatus);
+		}
+		free(pids);
+		free(args);
+		return status;
+}
+
+
 /* Change the working directory of the shell to dir, 
    provided it is a directory and the shell has the appropriate permissions. 
    Without an argument, it changes the working directory to the home directory.
 Note: We are not handling tilde expansion.
  */
-void exec_cd(Cmd c) {
+int exec_cd(Cmd c) {
 		int ret;
 		char* home = getenv("HOME");
 		if (c->args[1] == NULL) {
 				chdir(home);
-				return;
+				return 0;
 		}
 
+		flush_stat_cache(); // relative paths mean something else now
 		ret = chdir(c->args[1]);
 		if(ret == -1) {
 				switch(errno) {
@@ -514,15 +1397,17 @@ void exec_cd(Cmd c) {
 						case ENOTDIR: 
 								printf("%s: Not a directory.\n", c->args[1]);
 				}
+				return 1;
 		}
+		return 0;
 }
 
 
 /* Format: echo <word>
    Write each word to the shell’s standard output, separated by spaces and terminated with a newline.
-   Note: Not handling variable expansion, e.g. echo abc*, echo $PATH
+   Note: $variables are substituted and patterns like abc* are globbed before we get here
  */
-void exec_echo(Cmd c) {
+int exec_echo(Cmd c) {
 		int i=0;
 
 		while(c->args[++i] != NULL)
@@ -530,82 +1415,767 @@ void exec_echo(Cmd c) {
 
 		if(i != 1)
 				printf("\n");
+		return 0;
 }
 
 
-/* Exit the shell
+/* Format: limit [-h] [resource [maximum-use]]
+   Limits the consumption of a resource by the shell and the commands it starts to maximum-use, 
+   or, with -h, sets the hard limit, which only the superuser may raise again.
+   Without maximum-use, shows the limit of the resource, without resource all of them.
+   Resources are cputime, filesize, datasize, stacksize, coredumpsize, memoryuse, vmemoryuse, 
+   memorylocked, descriptors and maxproc, a unique prefix will do.
+   maximum-use is unlimited, a number of kbytes for sizes (or with a k, m or g scale factor), 
+   a number of seconds for cputime (or with an h, m or s, or as mm:ss).
+   A resource with a . in its name is a cgroup control file (limit memory.max 512M): 
+   with setenv cgroup, it is set in the cgroup of every pipeline.
  */
-void exec_logout(Cmd c) {
-		exit(0);
+int exec_limit(Cmd c) {
+		struct rlimit rl;
+		rlim_t value;
+		int i = 1, k, hard = 0;
+
+		if(c->nargs > 1 && strcmp(c->args[1], "-h") == 0) {
+				hard = 1;
+				i = 2;
+		}
+		if(i >= c->nargs) {
+				for(k = 0; k < (int)(sizeof(limits)/sizeof(limits[0])); k++)
+						print_limit(k, hard);
+				cgroupList();
+				return 0;
+		}
+
+		if(strchr(c->args[i], '.') != NULL) {
+				if(i + 1 >= c->nargs) {
+						fprintf(stderr, "Usage: limit %s value.\n", c->args[i]);
+						return 1;
+				}
+				if(cgroupSet(c->args[i], c->args[i+1]) == -1) {
+						fprintf(stderr, "limit: Too many cgroup settings.\n");
+						return 1;
+				}
+				return 0;
+		}
+
+		if((k = find_limit(c->args[i])) == -1)
+				return 1;
+		if(i + 1 >= c->nargs) {
+				print_limit(k, hard);
+				return 0;
+		}
+		if(parse_limit(k, c->args[i+1], &value) == -1) {
+				fprintf(stderr, "limit: Improper or unknown scale factor.\n");
+				return 1;
+		}
+
+		getrlimit(limits[k].resource, &rl);
+		if(hard) {
+				rl.rlim_max = value;
+				if(rl.rlim_cur > value)
+						rl.rlim_cur = value;
+		} else
+				rl.rlim_cur = value;
+		if(setrlimit(limits[k].resource, &rl) == -1) {
+				perror("limit");
+				return 1;
+		}
+		return 0;
 }
 
 
-/* Format: nice [[+/-]<number>] [<command>]
-   Sets the scheduling priority for the shell to number, or, without number, to 4. 
-   With command, runs command at the appropriate priority. 
-   The greater the number, the less cpu the process gets.
+/* Format: exec [command]
+   Executes command in place of the shell, with the redirections of the exec.
+   Without command, the redirections are made for the shell itself (exec 2>log).
+   If the command can't be executed, the shell exits all the same, as csh does: 
+   exec_args() has set the signals and the scheduling up for the command, not for a shell.
  */
-void exec_nice(Cmd c) {
-		int which, who, priority;
-		char **cmd = NULL;
-
-		which = PRIO_PROCESS; // The value of which can be one of PRIO_PROCESS, PRIO_PGRP, or PRIO_USER
-		who = 0; //  A zero value for who denotes the calling process
-		priority = 4; // The default priority is 0; lower priorities cause more favorable scheduling.
+int exec_exec(Cmd c) {
+		if(c->nargs < 2) {
+				keep_fds = 1;
+				return 0;
+		}
+		exit(exec_args(&c->args[1]));
+}
 
-		if(c->nargs > 1) {
-				if(is_number(c->args[1]) == 1) {  // nice <priority> or nice <priority> <command>
-						priority = atoi(c->args[1]);
 
-						if(priority < -19)
-								priority = -19;
+/* format: load [file...]
+   Loads the shared objects, whose ush_init() adds builtins to the shell (see builtin.h). 
+   A file without a / is looked for as dlopen() does, in LD_LIBRARY_PATH and the system's library directories.
+   Without a file, prints the builtins loaded.
+ */
+int exec_load(Cmd c) {
+		int (*init)(void);
+		void *handle;
+		int i, status = 0;
+
+		if(c->nargs == 1) {
+				for(i = sizeof(builtin_cmds)/sizeof(builtin_cmds[0]); i < builtin_cmd_count; i++)
+						printf("%s\n", builtin_cmd_handle[i].cmd_name);
+				return 0;
+		}
+		for(i = 1; i < c->nargs; i++) {
+				handle = dlopen(c->args[i], RTLD_NOW | RTLD_LOCAL);
+				if(handle == NULL) {
+						fprintf(stderr, "load: %s\n", dlerror());
+						status = 1;
+						continue;
+				}
+				*(void **)&init = dlsym(handle, "ush_init");
+				if(init == NULL) {
+						fprintf(stderr, "load: %s: No ush_init.\n", c->args[i]);
+						dlclose(handle);
+						status = 1;
+				} else if(init() != 0) { // what it added stays, so it is never closed
+						fprintf(stderr, "load: %s: Initialization failed.\n", c->args[i]);
+						status = 1;
+				}
+		}
+		return status;
+}
+
+
+/* Adds a builtin, for the shared objects loaded by load; one they loaded before is replaced. 
+   Returns 0, or -1 if name is a builtin of the shell.
+ */
+int add_builtin(char *name, int (*exec_cmd)(Cmd)) {
+		int i, n = sizeof(builtin_cmds)/sizeof(builtin_cmds[0]);
+
+		i = is_builtin(name);
+		if(i != -1 && i < n) {
+				fprintf(stderr, "load: %s: Is a builtin.\n", name);
+				return -1;
+		}
+		if(i != -1) {
+				builtin_cmd_handle[i].exec_cmd = exec_cmd;
+				return 0;
+		}
+
+		if(builtin_cmd_handle == builtin_cmds) {
+				builtin_cmd_handle = malloc(sizeof(builtin_cmds));
+				if(builtin_cmd_handle == NULL) {
+						perror("malloc");
+						exit(errno);
+				}
+				memcpy(builtin_cmd_handle, builtin_cmds, sizeof(builtin_cmds));
+		}
+		builtin_cmd_handle = realloc(builtin_cmd_handle, (builtin_cmd_count + 1) * sizeof(builtin_cmd_handle[0]));
+		if(builtin_cmd_handle == NULL) {
+				perror("realloc");
+				exit(errno);
+		}
+		builtin_cmd_handle[builtin_cmd_count].cmd_name = strdup(name);
+		builtin_cmd_handle[builtin_cmd_count].exec_cmd = exec_cmd;
+		builtin_cmd_count++;
+		return 0;
+}
+
+
+/* Exit the shell
+ */
+int exec_logout(Cmd c) {
+		(void)c;
+		exit(0);
+}
+
+
+/* format: memo [-r] [-e VAR]... [-f file]... command
+   Runs command, keeping its output, and when the same command is run again with the same input, 
+   writes the output kept instead of running it.
+   The input is the words of the command, the working directory, the files named by its words, 
+   the environment variables given with -e and the files given with -f; 
+   a file is the same if its size and modification time are.
+   Only the output of a command that succeeded is kept. It is written once the command is done.
+   -r runs the command even if its output is kept, and keeps the new one.
+   The outputs are kept in $MEMO_DIR, else in ~/.cache/ush/memo.
+ */
+int exec_memo(Cmd c) {
+		char **vars, **files, *path, *tmp;
+		struct stat st, out;
+		int first = 1, nvars = 0, nfiles = 0, refresh = 0, status, fd, saved, kept;
+
+		vars = malloc(c->nargs * sizeof(char *));
+		files = malloc(c->nargs * sizeof(char *));
+		if(vars == NULL || files == NULL) {
+				perror("malloc");
+				exit(errno);
+		}
+		for(; first < c->nargs && c->args[first][0] == '-'; first++)
+				if(strcmp(c->args[first], "-r") == 0)
+						refresh = 1;
+				else if(strcmp(c->args[first], "-e") == 0 && first + 1 < c->nargs)
+						vars[nvars++] = c->args[++first];
+				else if(strcmp(c->args[first], "-f") == 0 && first + 1 < c->nargs)
+						files[nfiles++] = c->args[++first];
+				else
+						break;
+		if(first == c->nargs || c->args[first][0] == '-') {
+				fprintf(stderr, "Usage: memo [-r] [-e VAR]... [-f file]... command.\n");
+				free(vars);
+				free(files);
+				return 1;
+		}
+
+		path = memoPath(&c->args[first], c->nargs - first, vars, nvars, files, nfiles);
+		free(vars);
+		free(files);
+		if(path == NULL) // no cache, run it all the same
+				return run_cmd(sub_cmd(c, first));
+
+		fflush(stdout);
+		if(!refresh) {
+				if(memoReplay(path, 1) == 0) {
+						free(path);
+						return 0;
+				}
+				if(errno != ENOENT) {
+						perror("memo");
+						free(path);
+						return 1;
+				}
+		}
+
+		if((fd = memoCreate(path, &tmp)) < 0) {
+				free(path);
+				return run_cmd(sub_cmd(c, first));
+		}
+		saved = fcntl(1, F_DUPFD_CLOEXEC, 10);
+		dup2(fd, 1);
+		status = run_cmd(sub_cmd(c, first));
+		fflush(stdout); // a builtin's output
+		// the output went to the file only if nothing redirected it elsewhere meanwhile
+		kept = fstat(1, &out) == 0 && fstat(fd, &st) == 0 && out.st_dev == st.st_dev && out.st_ino == st.st_ino;
+		close(fd);
+		dup2(saved, 1);
+		close(saved);
+
+		if(memoReplay(tmp, 1) < 0) {
+				perror("memo");
+				status = 1;
+		}
+		memoKeep(tmp, path, status == 0 && kept);
+		free(tmp);
+		free(path);
+		return status;
+}
+
+
+/* Format: nice [[+/-]<number>] [<command>]
+   Sets the scheduling priority for the shell to number, or, without number, to 4. 
+   With command, runs command at the appropriate priority, the shell's priority is left alone. 
+   The greater the number, the less cpu the process gets.
+ */
+int exec_nice(Cmd c) {
+		int which, who, priority;
+		struct spawn_attr_t saved;
+		int first = 0;
+		int status = 0;
+
+		which = PRIO_PROCESS; // The value of which can be one of PRIO_PROCESS, PRIO_PGRP, or PRIO_USER
+		who = 0; //  A zero value for who denotes the calling process
+		priority = 4; // The default priority is 0; lower priorities cause more favorable scheduling.
+
+		if(c->nargs > 1) {
+				if(is_number(c->args[1]) == 1) {  // nice <priority> or nice <priority> <command>
+						priority = atoi(c->args[1]);
+
+						if(priority < -19)
+								priority = -19;
 						else if(priority > 20)
 								priority = 20;
 
 						if (c->args[2])			
-								cmd = &c->args[2];
+								first = 2;
 
 				} else { // nice <command>
-						cmd = &c->args[1];
+						first = 1;
 				}			
 		}
 
+		if(first == 0) {
+				/* Set the priority of the shell. 
+				   Note: Only the superuser may lower priorities.
+				 */
+				setpriority(which, who, priority);
+				//printf("priority: %d\n", priority); 
+				return 0;
+		}
 
-		/* Set the priority of the shell. 
-           Note: Only the superuser may lower priorities.
+		/* The priority is set in the child. 
+		   The nice value is preserved across execve.
 		 */
+		saved = spawn_attr;
+		spawn_attr.set_nice = 1;
+		spawn_attr.nice = priority;
+		status = run_cmd(sub_cmd(c, first));
+		spawn_attr = saved;
+		return status;
+}
 
-		setpriority(which, who, priority);
-		//printf("priority: %d\n", priority); 
 
-		if(cmd != NULL)	{
-				//printf("command:%s\n", *cmd);
-				Cmd temp;
-				temp = malloc(sizeof(struct cmd_t));
-				temp->args = cmd; //malloc(sizeof(char*));
-				//temp->args[0] = malloc(strlen(cmd));
+/* format: repeat [-j jobs] [-q] count command
+   Runs command count times. The command is parsed and expanded once, every run is started from it.
+   With -j, up to jobs runs of an external command go at a time; a builtin or a function runs in the shell, one run after the other.
+   A run killed by a signal, or CTRL+C during a builtin, stops the others from starting.
+   Reports on stderr the time of each run as it ends, then the total time and the mean, shortest and longest run;
+   -q leaves the report out.
+   The status is that of the last run that failed, 0 if none did.
+ */
+int exec_repeat(Cmd c) {
+		struct timespec start, *started;
+		double ms, total_ms, min_ms = -1, max_ms = 0, sum_ms = 0;
+		long count, done = 0, run, *runs;
+		int first = 1, jobs = 1, quiet = 0, running = 0, status = 0, run_status, interrupted = 0, wstatus, k;
+		pid_t *pids, pid;
+		Cmd temp;
+
+		for(; first < c->nargs && c->args[first][0] == '-'; first++)
+				if(strcmp(c->args[first], "-q") == 0)
+						quiet = 1;
+				else if(strcmp(c->args[first], "-j") == 0 && first + 1 < c->nargs && is_number(c->args[first + 1]))
+						jobs = atoi(c->args[++first]);
+				else
+						break;
+		if(c->nargs < first + 2 || jobs < 1 || !is_number(c->args[first]) || (count = atol(c->args[first])) < 0) {
+				fprintf(stderr, "Usage: repeat [-j jobs] [-q] count command.\n");
+				return 1;
+		}
+		// per slot of a running run: its pid, when it started, which run it is
+		pids = malloc(jobs * sizeof(pid_t));
+		started = malloc(jobs * sizeof(struct timespec));
+		runs = malloc(jobs * sizeof(long));
+		if(pids == NULL || started == NULL || runs == NULL) {
+				perror("malloc");
+				exit(errno);
+		}
+		temp = sub_cmd(c, first + 1);
+		clock_gettime(CLOCK_MONOTONIC, &start);
+
+		while((done < count && !interrupted) || running > 0) {
+				if(running == jobs || done == count || interrupted) {
+						k = wait_slot(pids, running, &wstatus);
+						ms = elapsed_ms(&started[k]);
+						run = runs[k];
+						running--;
+						pids[k] = pids[running];
+						started[k] = started[running];
+						runs[k] = runs[running];
+						run_status = exit_status(wstatus);
+						if(WIFSIGNALED(wstatus))
+								interrupted = 1; // let those running finish
+				} else {
+						clock_gettime(CLOCK_MONOTONIC, &started[running]);
+						runs[running] = run = ++done;
+						pid = start_cmd(temp);
+						if(pid > 0) {
+								pids[running++] = pid;
+								continue;
+						}
+						// a builtin or a function, which has run in the shell, and has no signal to die of
+						ms = elapsed_ms(&started[running]);
+						run_status = pid < 0 ? 1 : last_status;
+						if(eventPending()) {
+								interrupted = 1;
+								run_status = 128 + SIGINT;
+						}
+				}
 
-				temp->in = temp->out = Tnil;
-				//strcpy(temp->args[0], cmd);
+				if(run_status != 0)
+						status = run_status;
+				if(min_ms < 0 || ms < min_ms)
+						min_ms = ms;
+				if(ms > max_ms)
+						max_ms = ms;
+				sum_ms += ms;
+				if(!quiet)
+						fprintf(stderr, "run %ld: %.3fms\n", run, ms);
+		}
+		total_ms = elapsed_ms(&start);
+
+		if(!quiet && done > 0)
+				fprintf(stderr, "%ld runs in %.3fs: %.3fms per run (min %.3fms, max %.3fms)\n", 
+								done, total_ms / 1e3, sum_ms / done, min_ms, max_ms);
+		free(temp);
+		free(runs);
+		free(started);
+		free(pids);
+		return status;
+}
 
-				/* A child created by fork inherits its parent's nice value. 
-				   The nice value is preserved across execve.
-				 */
-				process_cmd(temp);
 
-				//free(temp->args[0]);
-				//free(temp->args);
-				free(temp);
+/* Format: sched [-c cpus] [-p policy[:priority]] [-i class[:level]] command
+   Runs command with a CPU affinity, a scheduling policy and an I/O priority, 
+   which are set in the child, the shell's own are left alone.
+   cpus is a list like 0-3,6.
+   policy is other, batch, idle, fifo or rr; priority (1 to 99, default 1) is for fifo and rr.
+   class is rt, be or idle; level is 0 (highest) to 7, default 4.
+   Like nice, sched can prefix another: sched -c 2 nice 10 make.
+ */
+int exec_sched(Cmd c) {
+		static char *policies[] = {"other", "batch", "idle", "fifo", "rr"};
+		static int policy_ids[] = {SCHED_OTHER, SCHED_BATCH, SCHED_IDLE, SCHED_FIFO, SCHED_RR};
+		static char *classes[] = {"rt", "be", "idle"};
+		struct spawn_attr_t saved;
+		char *arg, *colon;
+		int i, k, level, status;
+
+		saved = spawn_attr;
+		for(i = 1; i + 1 < c->nargs && c->args[i][0] == '-'; i += 2) {
+				arg = c->args[i+1];
+				colon = strchr(arg, ':');
+				if(colon != NULL)
+						*colon++ = '\0';
+
+				if(strcmp(c->args[i], "-c") == 0) {
+						if(colon != NULL || parse_cpus(arg, &spawn_attr.cpus) == -1)
+								goto usage;
+						spawn_attr.set_cpus = 1;
+
+				} else if(strcmp(c->args[i], "-p") == 0) {
+						for(k = 0; k < 5 && strcmp(arg, policies[k]) != 0; k++)
+								;
+						if(k == 5)
+								goto usage;
+						spawn_attr.set_policy = 1;
+						spawn_attr.policy = policy_ids[k];
+						spawn_attr.prio = 0;
+						if(spawn_attr.policy == SCHED_FIFO || spawn_attr.policy == SCHED_RR)
+								spawn_attr.prio = colon != NULL ? atoi(colon) : 1;
+						else if(colon != NULL)
+								goto usage;
+
+				} else if(strcmp(c->args[i], "-i") == 0) {
+						for(k = 0; k < 3 && strcmp(arg, classes[k]) != 0; k++)
+								;
+						level = colon != NULL ? atoi(colon) : k == 2 ? 0 : 4;
+						if(k == 3 || level < 0 || level > 7)
+								goto usage;
+						spawn_attr.set_ioprio = 1;
+						spawn_attr.ioprio = (k + 1) << 13 | level; // IOPRIO_PRIO_VALUE(class, level)
+
+				} else
+						goto usage;
+		}
+		if(i >= c->nargs)
+				goto usage;
+
+		status = run_cmd(sub_cmd(c, i));
+		spawn_attr = saved;
+		return status;
+
+usage:
+		fprintf(stderr, "Usage: sched [-c cpus] [-p policy[:priority]] [-i class[:level]] command.\n");
+		spawn_attr = saved;
+		return 1;
+}
+
+
+/* Sets up the attributes of nice and sched in the child of the command, before it is executed.
+   A setting that fails stops the command, with the status of a command that could not be executed (126).
+ */
+void apply_spawn_attr() {
+		struct sched_param param;
+
+		if(spawn_attr.set_nice)
+				setpriority(PRIO_PROCESS, 0, spawn_attr.nice); // only the superuser may lower it, try anyway
+		if(spawn_attr.set_cpus && sched_setaffinity(0, sizeof(cpu_set_t), &spawn_attr.cpus) == -1) {
+				perror("sched_setaffinity");
+				tell_not_run();
+				exit(126);
+		}
+		if(spawn_attr.set_policy) {
+				memset(&param, 0, sizeof(param));
+				param.sched_priority = spawn_attr.prio;
+				if(sched_setscheduler(0, spawn_attr.policy, &param) == -1) {
+						perror("sched_setscheduler");
+						tell_not_run();
+						exit(126);
+				}
+		}
+		if(spawn_attr.set_ioprio && syscall(SYS_ioprio_set, 1 /* IOPRIO_WHO_PROCESS */, 0, spawn_attr.ioprio) == -1) {
+				perror("ioprio_set");
+				tell_not_run();
+				exit(126);
+		}
+}
+
+
+/* Makes a command of the words of c from first on, for the built-ins that run a command (nice, sched, timeout).
+   The words are shared with c; free the command with free().
+ */
+Cmd sub_cmd(Cmd c, int first) {
+		Cmd temp;
+
+		temp = calloc(1, sizeof(struct cmd_t));
+		if(temp == NULL) {
+				perror("calloc");
+				exit(errno);
+		}
+		temp->args = &c->args[first];
+		temp->nargs = c->nargs - first;
+		temp->in = temp->out = Tnil;
+		temp->next = NULL;
+		return temp;
+}
+
+
+/* Starts a command made by sub_cmd(), as process_cmd() does. 
+   The pipe redirections of the pipeline are done already where the built-in running it is, 
+   and it may have redirected more itself (memo), so the command is a pipeline of its own, 
+   whose input and output are descriptors 0 and 1 as they are: 
+   doing the redirections of the outer pipeline again would undo those of the built-in.
+ */
+int start_cmd(Cmd c) {
+		int saved_pipes[2][2], saved_pipenum;
+		pid_t child_pid;
+
+		saved_pipenum = pipenum;
+		memcpy(saved_pipes, mypipes, sizeof(mypipes));
+		pipenum = 0;
+		mypipes[0][0] = mypipes[1][1] = -1;
+		mypipes[1][0] = 0; // mypipes[!pipenum][0], the input
+		mypipes[0][1] = 1; // mypipes[pipenum][1], the output
+		child_pid = process_cmd(c);
+		memcpy(mypipes, saved_pipes, sizeof(mypipes));
+		pipenum = saved_pipenum;
+		return child_pid;
+}
+
+
+/* Runs a command made by sub_cmd(), waits for it and frees it.
+   Returns its exit status.
+ */
+int run_cmd(Cmd c) {
+		pid_t child_pid;
+		int status;
+
+		child_pid = start_cmd(c);
+		if(child_pid > 0) {
+				eventWait(&child_pid, 1, &status, -1);
+				status = exit_status(status);
+		} else if(child_pid == 0)
+				status = last_status;
+		else
+				status = 1;
+		free(c);
+		return status;
+}
+
+
+/* format: printf format [arguments]
+   Writes the arguments under the control of format, as printf(1) does.
+   Escapes: \\ \a \b \f \n \r \t \v, \NNN (octal), and \c, which ends the output.
+   Conversions: %d %i %o %u %x %X %c %s %e %E %f %F %g %G %a %A, with flags, width and precision 
+   (* takes them from an argument), %b, a string with escapes, and %%.
+   The format is used again as long as arguments are left; missing arguments are empty or 0.
+   The status is 1 if an argument is not a number, or the format has a bad conversion.
+ */
+int exec_printf(Cmd c) {
+		char *f, *arg, spec[64], *text;
+		int n = 2, first, status = 0, stop = 0, len, star, prec;
+		size_t size;
+		FILE *out;
+
+		if(c->nargs < 2) {
+				fprintf(stderr, "printf: Too few arguments.\n");
+				return 1;
 		}
+		do {
+				first = n;
+				for(f = c->args[1]; *f != '\0' && !stop; ) {
+						if(*f == '\\') {
+								f += printf_escape(stdout, f, 0, &stop);
+								continue;
+						}
+						if(*f != '%') {
+								putchar(*f++);
+								continue;
+						}
+						if(f[1] == '%') {
+								putchar('%');
+								f += 2;
+								continue;
+						}
+
+						// %[flags][width][.precision], with the numbers of * filled in
+						len = 0;
+						spec[len++] = *f++;
+						while(*f != '\0' && strchr("-+ #0", *f) != NULL && len < 16)
+								spec[len++] = *f++;
+						if(*f == '*') {
+								star = printf_integer(n < c->nargs ? c->args[n++] : NULL, &status);
+								len += snprintf(spec + len, 24, "%d", star);
+								f++;
+						} else
+								while(isdigit((unsigned char)*f) && len < 40)
+										spec[len++] = *f++;
+						prec = len;
+						if(*f == '.') {
+								f++;
+								if(*f == '*') {
+										star = printf_integer(n < c->nargs ? c->args[n++] : NULL, &status);
+										if(star >= 0) // a negative precision is none
+												len += snprintf(spec + len, 24, ".%d", star);
+										f++;
+								} else {
+										spec[len++] = '.';
+										while(isdigit((unsigned char)*f) && len < 56)
+												spec[len++] = *f++;
+								}
+						}
+						if(*f == '\0' || strchr("diouxXcsbeEfFgGaA", *f) == NULL) {
+								fprintf(stderr, "printf: %%%c: Invalid conversion.\n", *f ? *f : ' ');
+								return 1;
+						}
+						arg = n < c->nargs ? c->args[n++] : NULL;
+						switch(*f) {
+								case 'd':
+								case 'i':
+										strcpy(spec + len, "lld");
+										printf(spec, printf_integer(arg, &status));
+										break;
+								case 'o':
+								case 'u':
+								case 'x':
+								case 'X':
+										sprintf(spec + len, "ll%c", *f);
+										printf(spec, (unsigned long long)printf_integer(arg, &status));
+										break;
+								case 'c':
+										strcpy(spec + prec, ".1s"); // any precision given is dropped; nothing at all for an empty argument
+										printf(spec, arg ? arg : "");
+										break;
+								case 's':
+										strcpy(spec + len, "s");
+										printf(spec, arg ? arg : "");
+										break;
+								case 'b':
+										text = NULL;
+										out = open_memstream(&text, &size);
+										for(; arg != NULL && *arg != '\0' && !stop; )
+												if(*arg == '\\')
+														arg += printf_escape(out, arg, 1, &stop);
+												else
+														putc(*arg++, out);
+										fclose(out);
+										strcpy(spec + len, "s");
+										printf(spec, text);
+										free(text);
+										break;
+								default:
+										sprintf(spec + len, "%c", *f);
+										if(arg != NULL && (arg[0] == '\'' || arg[0] == '"'))
+												printf(spec, (double)(unsigned char)arg[1]);
+										else
+												printf(spec, arg ? strtod(arg, NULL) : 0.0);
+						}
+						f++;
+				}
+		} while(n < c->nargs && n > first && !stop);
+		return status;
 }
 
 
 /* Print the current working directory.
  */
-void exec_pwd(Cmd c) {
+int exec_pwd(Cmd c) {
 		char path[PATH_MAX];
-		getcwd(path, sizeof(path));
+		(void)c;
+		if(getcwd(path, sizeof(path)) == NULL) {
+				perror("pwd");
+				return 1;
+		}
 		printf("%s\n", path);
+		return 0;
+}
+
+
+/* format: read VAR...
+   Reads a line from the standard input and sets each VAR to a word of it (words are separated by blanks), 
+   the last VAR to the rest of the line. VARs left without a word are set to the null string.
+   Only the line is taken from the input, in blocks rather than a byte at a time (see input.c), 
+   so the commands after read get the rest of it.
+   The status is 1 at the end of the input.
+ */
+int exec_read(Cmd c) {
+		char *line, *p, *word, empty[1] = "";
+		size_t len;
+		int i, status;
+
+		if(c->nargs < 2) {
+				printf("read: Too few arguments.\n");
+				return 1;
+		}
+		for(i = 1; i < c->nargs; i++)
+				if(!varName(c->args[i])) {
+						printf("read: Variable name must begin with a letter.\n");
+						return 1;
+				}
+
+		line = inputLine(0, &len);
+		if(line == NULL && errno == EINTR) // CTRL+C at a terminal
+				return 128 + SIGINT;
+		if(line == NULL && errno != 0)
+				perror("read");
+		status = line == NULL;
+		p = line != NULL ? line : empty;
+		for(i = 1; i < c->nargs; i++) {
+				p += strspn(p, " \t");
+				word = p;
+				if(i + 1 < c->nargs) {
+						p += strcspn(p, " \t");
+						if(*p != '\0')
+								*p++ = '\0';
+				} else { // the rest of the line, without the blanks at its end
+						for(len = strlen(p); len > 0 && (p[len - 1] == ' ' || p[len - 1] == '\t'); len--)
+								;
+						p[len] = '\0';
+				}
+				varSet(c->args[i], &word, 1);
+		}
+		free(line);
+		return status;
+}
+
+
+/* format: set [VAR [= word | = ( words )]]
+   Without arguments, prints the names and values of all shell variables. 
+   Given VAR, sets the shell variable VAR to word or to the list of words or, without a value, to the null string.
+   Several VAR = word may be given. The value of a variable is substituted for $VAR.
+ */
+int exec_set(Cmd c) {
+		int i = 1, j;
+
+		if(c->nargs == 1) {
+				varList();
+				return 0;
+		}
+		while(i < c->nargs) {
+				if(!varName(c->args[i])) {
+						printf("set: Variable name must begin with a letter.\n");
+						return 1;
+				}
+				if(i + 1 == c->nargs || strcmp(c->args[i + 1], "=") != 0) { // set VAR
+						varSet(c->args[i], &c->args[i], 0);
+						i++;
+				} else if(i + 2 < c->nargs && strcmp(c->args[i + 2], "(") == 0) { // set VAR = ( words )
+						for(j = i + 3; j < c->nargs && strcmp(c->args[j], ")") != 0; j++)
+								;
+						if(j == c->nargs) {
+								printf("set: Too many ('s.\n");
+								return 1;
+						}
+						varSet(c->args[i], &c->args[i + 3], j - i - 3);
+						i = j + 1;
+				} else if(i + 2 < c->nargs) { // set VAR = word
+						varSet(c->args[i], &c->args[i + 2], 1);
+						i += 3;
+				} else {
+						printf("set: Syntax Error.\n");
+						return 1;
+				}
+		}
+		return 0;
 }
 
 
@@ -613,35 +2183,235 @@ void exec_pwd(Cmd c) {
    Without arguments, prints the names and values of all environment variables. 
    Given VAR, sets the environment variable VAR to word or, without word, to the null string.
  */
-void exec_setenv(Cmd c) {
+int exec_setenv(Cmd c) {
 		int i;
 		if (c->args[1] == NULL) {
 				for (i = 0; environ[i] != NULL; i++) 
 						printf("%s\n", environ[i]);			
 		} else
-				setenv(c->args[1], c->args[2], 1);
+				setenv(c->args[1], c->args[2] ? c->args[2] : "", 1);
+		return 0;
+}
+
+
+/* format: test expr, or [ expr ]
+   Evaluates expr, with the status 0 if it is true, 1 if it is false and 2 if it is not an expression.
+   Files: -b -c -d -e -f -g -h -L -k -p -r -s -S -u -w -x -O -G file, -t fd, file1 -nt -ot -ef file2.
+   Strings: -n s, -z s, s, s1 = s2 (or ==), s1 != s2, s1 < s2, s1 > s2.
+   Integers: n1 -eq -ne -lt -le -gt -ge n2.
+   They combine with ! (not), -a (and), -o (or) and ( ). Files are looked at through the stat cache.
+ */
+int exec_test(Cmd c) {
+		struct test_state_t t;
+		int r;
+
+		t.args = c->args;
+		t.pos = 1;
+		t.end = c->nargs;
+		t.error = 0;
+		if(strcmp(c->args[0], "[") == 0) {
+				if(strcmp(c->args[t.end - 1], "]") != 0) {
+						fprintf(stderr, "[: Missing ].\n");
+						return 2;
+				}
+				t.end--;
+		}
+		if(t.pos == t.end) // no expression is false
+				return 1;
+		r = test_or(&t);
+		if(!t.error && t.pos < t.end) {
+				fprintf(stderr, "%s: %s: Expression Syntax.\n", c->args[0], c->args[t.pos]);
+				t.error = 1;
+		}
+		return t.error ? 2 : !r;
+}
+
+
+/* format: source file
+   Runs the commands of file in the shell itself, so that what they set (variables, environment, directory, limits) stays.
+   Sources can be nested.
+ */
+int exec_source(Cmd c) {
+		if(c->nargs < 2) {
+				printf("source: Too few arguments.\n");
+				return 1;
+		}
+		if(source_file(c->args[1]) < 0) {
+				printf("%s: %s.\n", c->args[1], errno == ELOOP ? "Too many nested sources" : strerror(errno));
+				return 1;
+		}
+		return last_status;
+}
+
+
+/* format: timeout [-k KILL_AFTER] DURATION command
+   Run the command, and send it SIGTERM if it is still running after DURATION, 
+   SIGKILL if it is still running KILL_AFTER (default 2s) later.
+   Durations are numbers of seconds, which may have a fraction and a suffix: s, m (minutes), h or d.
+   No extra process is involved: the shell waits for the command's pidfd with a deadline.
+   The status is that of the command, 124 if it timed out, or 137 if it had to be killed.
+   A built-in command runs without a time limit.
+ */
+int exec_timeout(Cmd c) {
+		long ms, kill_ms = 2000;
+		int status = 0, i = 1;
+		pid_t child_pid, pid;
+		Cmd temp;
+
+		if(c->nargs > 2 && strcmp(c->args[1], "-k") == 0) {
+				kill_ms = duration_ms(c->args[2]);
+				i = 3;
+		}
+		if(c->nargs < i + 2 || kill_ms < 0 || (ms = duration_ms(c->args[i])) < 0) {
+				fprintf(stderr, "Usage: timeout [-k duration] duration command.\n");
+				return 1;
+		}
+
+		temp = sub_cmd(c, i + 1);
+		child_pid = start_cmd(temp);
+		if(child_pid > 0) {
+				if(ms == 0) // 0 disables the time limit
+						ms = -1;
+				pid = eventWait(&child_pid, 1, &status, ms);
+				if(pid > 0)
+						status = exit_status(status);
+				else if(pid == -1) { // not watched: it can't be waited for, nor signalled safely
+						fprintf(stderr, "timeout: %s: Lost track of the command.\n", c->args[i + 1]);
+						status = 1;
+				} else { // 0, the time is up
+						eventKill(&child_pid, 1, SIGTERM);
+						status = 124;
+						if(eventWait(&child_pid, 1, &i, kill_ms) == 0) {
+								eventKill(&child_pid, 1, SIGKILL);
+								eventWait(&child_pid, 1, &i, -1);
+								status = 128 + SIGKILL;
+						}
+				}
+		} else if(child_pid == 0)
+				status = last_status;
+		else
+				status = 1;
+
+		free(temp);
+		return status;
+}
+
+
+/* Format: unlimit [-h] [resource]
+   Removes the limit of a resource, or of all of them: the limit becomes the hard limit, 
+   with -h the hard limit is removed too (only the superuser may do that).
+   A cgroup control file setting (see limit) is dropped.
+ */
+int exec_unlimit(Cmd c) {
+		struct rlimit rl;
+		int i = 1, k, n, hard = 0, status = 0;
+
+		if(c->nargs > 1 && strcmp(c->args[1], "-h") == 0) {
+				hard = 1;
+				i = 2;
+		}
+		if(i < c->nargs && strchr(c->args[i], '.') != NULL) {
+				cgroupSet(c->args[i], NULL);
+				return 0;
+		}
+
+		if(i < c->nargs) {
+				if((k = find_limit(c->args[i])) == -1)
+						return 1;
+				n = k + 1;
+		} else {
+				k = 0;
+				n = sizeof(limits)/sizeof(limits[0]);
+				cgroupSet(NULL, NULL);
+		}
+		for(; k < n; k++) {
+				getrlimit(limits[k].resource, &rl);
+				if(hard)
+						rl.rlim_max = RLIM_INFINITY;
+				rl.rlim_cur = rl.rlim_max;
+				if(setrlimit(limits[k].resource, &rl) == -1) {
+						fprintf(stderr, "unlimit: %s: %s.\n", limits[k].name, strerror(errno));
+						status = 1;
+				}
+		}
+		return status;
+}
+
+
+/* format: unalias pattern...
+   Removes the aliases whose names match the patterns.
+ */
+int exec_unalias(Cmd c) {
+		int i;
+
+		if(c->args[1] == NULL) {
+				printf("unalias: too few arguments\n");
+				return 1;
+		}
+		for(i = 1; i < c->nargs; i++)
+				aliasUnset(c->args[i]);
+		return 0;
+}
+
+
+/* format: unset VAR...
+   Removes the shell variables.
+ */
+int exec_unset(Cmd c) {
+		int i;
+
+		if(c->args[1] == NULL) {
+				printf("unset: too few arguments\n");
+				return 1;
+		}
+		for(i = 1; i < c->nargs; i++)
+				varUnset(c->args[i]);
+		return 0;
 }
 
 
 /* format: unsetenv VAR
    Remove environment variable whose name matches VAR.
  */
-void exec_unsetenv(Cmd c) {
-		if(c->args[1] == NULL)
+int exec_unsetenv(Cmd c) {
+		if(c->args[1] == NULL) {
 				printf("unsetenv: too few arguments\n");
-		else
-				unsetenv(c->args[1]);
+				return 1;
+		}
+		unsetenv(c->args[1]);
+		return 0;
 }
 
 
 /* format: where command
-   Reports all known instances of command, including builtins and executables in path.
+   Reports all known instances of command, including aliases, functions, builtins and executables in path.
  */
-void exec_where(Cmd c) {
-		char *path, path_copy[PATH_MAX], *curr_path, abs_path[PATH_MAX];
+int exec_where(Cmd c) {
+		char *path, path_copy[PATH_MAX], *curr_path, abs_path[PATH_MAX], **words;
+		int found = 0, i, n;
 
-		if(is_builtin(c->args[1]) != -1)
+		if(c->args[1] == NULL) {
+				printf("where: too few arguments\n");
+				return 1;
+		}
+
+		if((words = aliasGet(c->args[1], &n)) != NULL) {
+				printf("%s is aliased to", c->args[1]);
+				for(i = 0; i < n; i++)
+						printf(" %s", words[i]);
+				printf("\n");
+				found = 1;
+		}
+
+		if(scriptFunction(c->args[1])) {
+				printf("%s is a function\n", c->args[1]);
+				found = 1;
+		}
+
+		if(is_builtin(c->args[1]) != -1) {
 				printf("%s\n", c->args[1]);
+				found = 1;
+		}
 
 		path = getenv("PATH");
 		//We don't want to modify the original PATH env variable
@@ -655,10 +2425,13 @@ void exec_where(Cmd c) {
 				strcat(abs_path, c->args[1]);
 				//printf("checking %s\n", abs_path);
 
-				if(is_valid_cmd(abs_path) == 1)
+				if(is_valid_cmd(abs_path) == 1) {
 						printf("%s\n",abs_path);
+						found = 1;
+				}
 				curr_path = strtok(NULL,":");
 		}
+		return !found;
 }
 
 
@@ -671,11 +2444,472 @@ int is_valid_cmd(char *path) {
 
 int is_dir(char *path) {
 		struct stat buf;
-		stat(path, &buf);
-		return buf.st_mode & S_IFDIR;
+		if(cached_stat(path, &buf, 1) != 0)
+				return 0;
+		return S_ISDIR(buf.st_mode);
 } 
 
 
+/* stat() (lstat() if follow is 0) through the stat cache. 
+   Returns 0, or -1 with errno set.
+ */
+int cached_stat(char *path, struct stat *st, int follow) {
+		struct stat_cache_t *e;
+		int i;
+
+		for(i = 0; i < stat_cache_n; i++) {
+				e = &stat_cache[i];
+				if(e->follow == follow && strcmp(e->path, path) == 0)
+						break;
+		}
+		if(i == stat_cache_n) {
+				if(stat_cache_n == STAT_CACHE_SIZE)
+						flush_stat_cache();
+				e = &stat_cache[stat_cache_n++];
+				e->path = strdup(path);
+				e->follow = follow;
+				e->error = (follow ? stat(path, &e->st) : lstat(path, &e->st)) == 0 ? 0 : errno;
+		}
+		if(e->error) {
+				errno = e->error;
+				return -1;
+		}
+		*st = e->st;
+		return 0;
+}
+
+
+void flush_stat_cache() {
+		while(stat_cache_n > 0)
+				free(stat_cache[--stat_cache_n].path);
+}
+
+
+/* The operators of test, from the lowest precedence up: expr -o expr, expr -a expr, ! expr, and the tests.
+   Each returns whether its part of the expression is true, and sets t->error if it is not an expression.
+ */
+int test_or(struct test_state_t *t) {
+		int r;
+
+		r = test_and(t);
+		while(!t->error && t->pos < t->end && strcmp(t->args[t->pos], "-o") == 0) {
+				t->pos++;
+				r = test_and(t) || r;
+		}
+		return r;
+}
+
+
+int test_and(struct test_state_t *t) {
+		int r;
+
+		r = test_not(t);
+		while(!t->error && t->pos < t->end && strcmp(t->args[t->pos], "-a") == 0) {
+				t->pos++;
+				r = test_not(t) && r;
+		}
+		return r;
+}
+
+
+int test_not(struct test_state_t *t) {
+		if(t->pos + 1 < t->end && strcmp(t->args[t->pos], "!") == 0) {
+				t->pos++;
+				return !test_not(t);
+		}
+		return test_primary(t);
+}
+
+
+/* ( expr ), a binary test, a unary test, or a string, which is true if it is not empty.
+ */
+int test_primary(struct test_state_t *t) {
+		static char *binary[] = {"=", "==", "!=", "<", ">", "-eq", "-ne", "-lt", "-le", "-gt", "-ge",
+				"-nt", "-ot", "-ef", NULL};
+		char **a = &t->args[t->pos];
+		int left = t->end - t->pos, i, r;
+
+		if(left == 0) {
+				fprintf(stderr, "%s: Argument expected.\n", t->args[0]);
+				t->error = 1;
+				return 0;
+		}
+		for(i = 0; left >= 3 && binary[i] != NULL; i++)
+				if(strcmp(a[1], binary[i]) == 0) {
+						t->pos += 3;
+						return test_binary(t, a[0], a[1], a[2]);
+				}
+		if(left >= 2 && strcmp(a[0], "(") == 0) {
+				t->pos++;
+				r = test_or(t);
+				if(!t->error && (t->pos == t->end || strcmp(t->args[t->pos], ")") != 0)) {
+						fprintf(stderr, "%s: Missing ).\n", t->args[0]);
+						t->error = 1;
+				}
+				t->pos++;
+				return r;
+		}
+		if(left >= 2 && a[0][0] == '-' && a[0][1] != '\0' && a[0][2] == '\0'
+		   && strchr("bcdefghLkprsStuwxOGnz", a[0][1]) != NULL) {
+				t->pos += 2;
+				return test_unary(t, a[0][1], a[1]);
+		}
+		t->pos++;
+		return a[0][0] != '\0';
+}
+
+
+int test_unary(struct test_state_t *t, char op, char *arg) {
+		struct stat st;
+		long long fd;
+
+		switch(op) {
+				case 'n':
+						return arg[0] != '\0';
+				case 'z':
+						return arg[0] == '\0';
+				case 't':
+						return test_integer(t, arg, &fd) && isatty(fd);
+				case 'r': // permissions are up to the kernel: ACLs, read-only mounts, root
+						return faccessat(AT_FDCWD, arg, R_OK, AT_EACCESS) == 0;
+				case 'w':
+						return faccessat(AT_FDCWD, arg, W_OK, AT_EACCESS) == 0;
+				case 'x':
+						return faccessat(AT_FDCWD, arg, X_OK, AT_EACCESS) == 0;
+		}
+		if(cached_stat(arg, &st, op != 'h' && op != 'L') != 0)
+				return 0;
+		switch(op) {
+				case 'b':
+						return S_ISBLK(st.st_mode);
+				case 'c':
+						return S_ISCHR(st.st_mode);
+				case 'd':
+						return S_ISDIR(st.st_mode);
+				case 'f':
+						return S_ISREG(st.st_mode);
+				case 'h':
+				case 'L':
+						return S_ISLNK(st.st_mode);
+				case 'p':
+						return S_ISFIFO(st.st_mode);
+				case 'S':
+						return S_ISSOCK(st.st_mode);
+				case 'g':
+						return (st.st_mode & S_ISGID) != 0;
+				case 'u':
+						return (st.st_mode & S_ISUID) != 0;
+				case 'k':
+						return (st.st_mode & S_ISVTX) != 0;
+				case 's':
+						return st.st_size > 0;
+				case 'O':
+						return st.st_uid == geteuid();
+				case 'G':
+						return st.st_gid == getegid();
+		}
+		return 1; // -e
+}
+
+
+int test_binary(struct test_state_t *t, char *a, char *op, char *b) {
+		struct stat sa, sb;
+		long long x, y;
+		int ea, eb, newer;
+
+		if(strcmp(op, "=") == 0 || strcmp(op, "==") == 0)
+				return strcmp(a, b) == 0;
+		if(strcmp(op, "!=") == 0)
+				return strcmp(a, b) != 0;
+		if(strcmp(op, "<") == 0)
+				return strcmp(a, b) < 0;
+		if(strcmp(op, ">") == 0)
+				return strcmp(a, b) > 0;
+
+		if(strcmp(op, "-nt") == 0 || strcmp(op, "-ot") == 0 || strcmp(op, "-ef") == 0) {
+				ea = cached_stat(a, &sa, 1);
+				eb = cached_stat(b, &sb, 1);
+				if(op[1] == 'e')
+						return ea == 0 && eb == 0 && sa.st_dev == sb.st_dev && sa.st_ino == sb.st_ino;
+				if(ea != 0 || eb != 0) // a file that exists is newer than one that does not
+						return op[1] == 'n' ? ea == 0 && eb != 0 : ea != 0 && eb == 0;
+				newer = sa.st_mtim.tv_sec != sb.st_mtim.tv_sec ? sa.st_mtim.tv_sec > sb.st_mtim.tv_sec
+						: sa.st_mtim.tv_nsec > sb.st_mtim.tv_nsec;
+				if(op[1] == 'n')
+						return newer;
+				return !newer && (sa.st_mtim.tv_sec != sb.st_mtim.tv_sec || sa.st_mtim.tv_nsec != sb.st_mtim.tv_nsec);
+		}
+
+		if(!test_integer(t, a, &x) || !test_integer(t, b, &y))
+				return 0;
+		if(strcmp(op, "-eq") == 0)
+				return x == y;
+		if(strcmp(op, "-ne") == 0)
+				return x != y;
+		if(strcmp(op, "-lt") == 0)
+				return x < y;
+		if(strcmp(op, "-le") == 0)
+				return x <= y;
+		if(strcmp(op, "-gt") == 0)
+				return x > y;
+		return x >= y; // -ge
+}
+
+
+/* Converts an argument of test to a number, which may have blanks around it.
+   Returns 1, or 0 if it is not a number (t->error is set).
+ */
+int test_integer(struct test_state_t *t, char *str, long long *value) {
+		char *end;
+
+		errno = 0;
+		*value = strtoll(str, &end, 10);
+		while(isspace((unsigned char)*end))
+				end++;
+		if(end == str || *end != '\0' || errno != 0) {
+				fprintf(stderr, "%s: %s: Badly formed number.\n", t->args[0], str);
+				t->error = 1;
+				return 0;
+		}
+		return 1;
+}
+
+
+/* Writes the escape at s (which begins with a \\) of the format of printf, or, if in_arg is set, of an argument of %b, 
+   where octal numbers are written \0NNN. \c sets *stop.
+   Returns the length of the escape.
+ */
+int printf_escape(FILE *out, char *s, int in_arg, int *stop) {
+		static char *from = "\\abfnrtv", *to = "\\\a\b\f\n\r\t\v";
+		char *p = s + 1;
+		int value = 0, i;
+
+		if(*p != '\0' && strchr(from, *p) != NULL) {
+				putc(to[strchr(from, *p) - from], out);
+				return 2;
+		}
+		if(*p == 'c') {
+				*stop = 1;
+				return 2;
+		}
+		if(in_arg && *p == '0')
+				p++;
+		for(i = 0; i < 3 && *p >= '0' && *p <= '7'; i++)
+				value = value * 8 + *p++ - '0';
+		if(i > 0 || p > s + 1) {
+				putc(value, out);
+				return p - s;
+		}
+		putc('\\', out); // not an escape
+		return 1;
+}
+
+
+/* Converts an argument of printf to a number: a decimal, octal (0NNN) or hexadecimal (0xNN) one, 
+   or the code of the character after a ' or ". A missing argument is 0.
+   If it is not a number, tells so and sets *status to 1.
+ */
+long long printf_integer(char *arg, int *status) {
+		char *end;
+		long long value;
+
+		if(arg == NULL)
+				return 0;
+		if(arg[0] == '\'' || arg[0] == '"')
+				return (unsigned char)arg[1];
+		errno = 0;
+		value = strtoll(arg, &end, 0);
+		if(end == arg || *end != '\0' || errno != 0) {
+				fprintf(stderr, "printf: %s: Badly formed number.\n", arg);
+				*status = 1;
+		}
+		return value;
+}
+
+
+/* Converts a status from waitpid() to an exit status: the exit code, or 128+signal number.
+ */
+int exit_status(int wstatus) {
+		if(WIFSIGNALED(wstatus))
+				return 128 + WTERMSIG(wstatus);
+		return WEXITSTATUS(wstatus);
+}
+
+
+/* Waits for one of the n children in pids, for the built-ins that keep several running (batch, repeat).
+   Returns its index in pids, its wait status in wstatus.
+ */
+int wait_slot(pid_t *pids, int n, int *wstatus) {
+		pid_t pid;
+		int k;
+
+		pid = eventWait(pids, n, wstatus, -1);
+		for(k = 0; k < n - 1 && pids[k] != pid; k++)
+				;
+		return k;
+}
+
+
+/* Returns the milliseconds since a time taken with clock_gettime(CLOCK_MONOTONIC).
+ */
+double elapsed_ms(struct timespec *since) {
+		struct timespec now;
+
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		return (now.tv_sec - since->tv_sec) * 1e3 + (now.tv_nsec - since->tv_nsec) / 1e6;
+}
+
+
+/* Converts a duration (seconds with an optional fraction and an s, m, h or d suffix) to milliseconds.
+   Returns -1 if it is not a duration.
+ */
+long duration_ms(char *str) {
+		char *end;
+		double d;
+
+		d = strtod(str, &end);
+		if(end == str || d < 0)
+				return -1;
+		switch(*end) {
+				case 'd':
+						d *= 24;
+						// fall through
+				case 'h':
+						d *= 60;
+						// fall through
+				case 'm':
+						d *= 60;
+						// fall through
+				case 's':
+						end++;
+		}
+		if(*end != '\0' || d * 1000 > INT_MAX)
+				return -1;
+		return (long)(d * 1000 + 0.5);
+}
+
+
+/* Reads a list of CPUs like 0-3,6 into cpus.
+   Returns -1 if it is not such a list.
+ */
+int parse_cpus(char *str, cpu_set_t *cpus) {
+		long from, to;
+		char *end;
+
+		CPU_ZERO(cpus);
+		do {
+				from = to = strtol(str, &end, 10);
+				if(end == str)
+						return -1;
+				if(*end == '-') {
+						str = end + 1;
+						to = strtol(str, &end, 10);
+						if(end == str)
+								return -1;
+				}
+				if(from < 0 || to < from || to >= CPU_SETSIZE)
+						return -1;
+				for(; from <= to; from++)
+						CPU_SET(from, cpus);
+				str = end + 1;
+		} while(*end == ',');
+		return *end == '\0' ? 0 : -1;
+}
+
+
+/* Returns the index in limits of a resource name, or of the only resource it is a prefix of, 
+   or -1 (after a message) if there is none.
+ */
+int find_limit(char *name) {
+		int k, found = -1, len = strlen(name);
+
+		for(k = 0; k < (int)(sizeof(limits)/sizeof(limits[0])); k++) {
+				if(strcmp(limits[k].name, name) == 0)
+						return k;
+				if(strncmp(limits[k].name, name, len) == 0) {
+						if(found != -1) {
+								fprintf(stderr, "%s: Ambiguous.\n", name);
+								return -1;
+						}
+						found = k;
+				}
+		}
+		if(found == -1)
+				fprintf(stderr, "%s: No such limit.\n", name);
+		return found;
+}
+
+
+/* Reads the maximum-use of limit for resource k (see exec_limit()).
+   Returns -1 if it is not one.
+ */
+int parse_limit(int k, char *str, rlim_t *value) {
+		char *end;
+		double d, s;
+
+		if(strcmp(str, "unlimited") == 0) {
+				*value = RLIM_INFINITY;
+				return 0;
+		}
+		d = strtod(str, &end);
+		if(end == str || d < 0)
+				return -1;
+
+		if(limits[k].scale == 0) { // cputime
+				if(*end == ':') {
+						str = end + 1;
+						s = strtod(str, &end);
+						if(end == str || s < 0)
+								return -1;
+						d = d * 60 + s;
+				} else if(*end == 'h') {
+						d *= 3600;
+						end++;
+				} else if(*end == 'm') {
+						d *= 60;
+						end++;
+				} else if(*end == 's')
+						end++;
+		} else if(limits[k].scale == 1024) {
+				d *= 1024;
+				if(*end == 'k')
+						end++;
+				else if(*end == 'm') {
+						d *= 1024;
+						end++;
+				} else if(*end == 'g') {
+						d *= 1024 * 1024;
+						end++;
+				}
+		}
+		if(*end != '\0' || d >= (double)RLIM_INFINITY)
+				return -1;
+		*value = (rlim_t)d;
+		return 0;
+}
+
+
+// Prints a line of limit: the name of resource k and its (soft or hard) limit.
+void print_limit(int k, int hard) {
+		struct rlimit rl;
+		rlim_t v;
+
+		getrlimit(limits[k].resource, &rl);
+		v = hard ? rl.rlim_max : rl.rlim_cur;
+		printf("%-16s", limits[k].name);
+		if(v == RLIM_INFINITY)
+				printf("unlimited\n");
+		else if(limits[k].scale == 0 && v >= 3600)
+				printf("%lu:%02lu:%02lu\n", (unsigned long)v / 3600, (unsigned long)v / 60 % 60, (unsigned long)v % 60);
+		else if(limits[k].scale == 0)
+				printf("%lu:%02lu\n", (unsigned long)v / 60, (unsigned long)v % 60);
+		else if(limits[k].scale == 1)
+				printf("%lu\n", (unsigned long)v);
+		else
+				printf("%lu kbytes\n", (unsigned long)(v / 1024));
+}
+
+
 int is_number(char* str) {
 		if (*str == '-') {
 				str++;
@@ -0,0 +1,291 @@
+/******************************************************************************
+ *
+ *  File Name........: memo.c
+ *
+ *  Description......:
+ *	The cache of memo, which keeps the output of commands that gave
+ *  the same output for the same input.  An entry is a file named by a
+ *  hash of what the output depends on:
+ *
+ *	the words of the command and the working directory
+ *	the values of the environment variables it is told of
+ *	the inode, size and modification time of the files among its
+ *		words, and of those it is told of
+ *
+ *  The entries are kept in $MEMO_DIR, else in ~/.cache/ush/memo.  An
+ *  entry is written under a temporary name and renamed once complete,
+ *  so a command running at the same time never reads half of one.
+ *
+ *****************************************************************************/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <sys/sendfile.h>
+#include "memo.h"
+
+#define FNV_BASIS	0xcbf29ce484222325ULL
+#define FNV_PRIME	0x100000001b3ULL
+
+// forward decls
+static char *cacheDir();
+static uint64_t hash(uint64_t, const void *, size_t);
+static uint64_t hashFile(uint64_t, const char *);
+
+/*-----------------------------------------------------------------------------
+ *
+ * Name...........: memoPath
+ *
+ * Description....: tells where the output of a command is cached,
+ * making the cache directory if need be.
+ *
+ * Input Param(s).: char **words, int n -- the command
+ *		char **vars, int nvars -- the environment variables it uses
+ *		char **files, int nfiles -- files it reads other than its
+ *		words
+ *
+ * Return Value(s): the path, malloc()ed, or NULL if there is no cache
+ * directory (message printed)
+ *
+ */
+
+char *memoPath(char **words, int n, char **vars, int nvars,
+	       char **files, int nfiles)
+{
+  char cwd[PATH_MAX], *dir, *path, *v;
+  uint64_t h = FNV_BASIS;
+  int i;
+
+  if ( (dir = cacheDir()) == NULL )
+    return NULL;
+
+  for ( i = 0; i < n; i++ )
+    h = hashFile(hash(h, words[i], strlen(words[i]) + 1), words[i]);
+  if ( getcwd(cwd, sizeof(cwd)) != NULL )
+    h = hash(h, cwd, strlen(cwd) + 1);
+  for ( i = 0; i < nvars; i++ ) {
+    h = hash(h, vars[i], strlen(vars[i]) + 1);
+    if ( (v = getenv(vars[i])) != NULL )	// unset differs from empty
+      h = hash(h, v, strlen(v) + 1);
+  }
+  for ( i = 0; i < nfiles; i++ )
+    h = hashFile(hash(h, files[i], strlen(files[i]) + 1), files[i]);
+
+  if ( asprintf(&path, "%s/%016llx", dir, (unsigned long long)h) < 0 ) {
+    perror("asprintf");
+    exit(errno);
+  }
+  free(dir);
+  return path;
+} /*---------- End of memoPath ----------------------------------------------*/
+
+/*-----------------------------------------------------------------------------
+ *
+ * Name...........: memoReplay
+ *
+ * Description....: writes a cached output.  The kernel copies it with
+ * sendfile(), read() and write() doing it where it can't.
+ *
+ * Input Param(s).: const char *path -- the entry
+ *		int fd -- where to write it
+ *
+ * Return Value(s): 0, or -1 if there is no such entry or it could not be
+ * written (errno set)
+ *
+ */
+
+int memoReplay(const char *path, int fd)
+{
+  char buf[8192];
+  struct stat st;
+  off_t off = 0;
+  ssize_t r = 0;
+  int in, e;
+
+  if ( (in = open(path, O_RDONLY | O_CLOEXEC)) < 0 )
+    return -1;
+  if ( fstat(in, &st) < 0 )
+    goto fail;
+  while ( off < st.st_size &&
+	  (r = sendfile(fd, in, &off, st.st_size - off)) > 0 )
+    ;
+  if ( r < 0 && (errno == EINVAL || errno == ENOSYS) ) {
+    lseek(in, off, SEEK_SET);
+    while ( (r = read(in, buf, sizeof(buf))) > 0 )
+      if ( write(fd, buf, r) != r ) {
+	r = -1;
+	break;
+      }
+  }
+  if ( r < 0 )
+    goto fail;
+  close(in);
+  return 0;
+
+ fail:
+  e = errno;
+  close(in);
+  errno = e;
+  return -1;
+} /*---------- End of memoReplay --------------------------------------------*/
+
+/*-----------------------------------------------------------------------------
+ *
+ * Name...........: memoCreate
+ *
+ * Description....: makes the temporary file an entry is written to.
+ *
+ * Input Param(s).: const char *path -- the entry
+ *		char **tmp -- set to the name of the file, malloc()ed
+ *
+ * Return Value(s): a descriptor of the file, or -1 (message printed)
+ *
+ */
+
+int memoCreate(const char *path, char **tmp)
+{
+  int fd;
+
+  if ( asprintf(tmp, "%s.XXXXXX", path) < 0 ) {
+    perror("asprintf");
+    exit(errno);
+  }
+  if ( (fd = mkostemp(*tmp, O_CLOEXEC)) < 0 ) {
+    perror(*tmp);
+    free(*tmp);
+  }
+  return fd;
+} /*---------- End of memoCreate --------------------------------------------*/
+
+/*-----------------------------------------------------------------------------
+ *
+ * Name...........: memoKeep
+ *
+ * Description....: ends the writing of an entry, keeping it or not.
+ *
+ * Input Param(s).: const char *tmp -- the file from memoCreate()
+ *		const char *path -- the entry
+ *		int keep -- whether to keep it
+ *
+ * Return Value(s): 0, or -1 if it could not be kept (message printed)
+ *
+ */
+
+int memoKeep(const char *tmp, const char *path, int keep)
+{
+  if ( keep && rename(tmp, path) == 0 )
+    return 0;
+  if ( keep )
+    perror(path);
+  unlink(tmp);
+  return keep ? -1 : 0;
+} /*---------- End of memoKeep ----------------------------------------------*/
+
+/*-----------------------------------------------------------------------------
+ *
+ * Name...........: cacheDir
+ *
+ * Description....: finds the cache directory, making it and its parents
+ * if need be.
+ *
+ * Input Param(s).: none
+ *
+ * Return Value(s): the directory, malloc()ed, or NULL (message printed)
+ *
+ */
+
+static char *cacheDir()
+{
+  char *dir, *home, *p = NULL;
+
+  if ( (dir = getenv("MEMO_DIR")) != NULL )
+    dir = strdup(dir);
+  else if ( (home = getenv("HOME")) != NULL ) {
+    if ( asprintf(&dir, "%s/.cache/ush/memo", home) < 0 )
+      dir = NULL;
+  }
+  else {
+    fprintf(stderr, "memo: No $HOME or $MEMO_DIR.\n");
+    return NULL;
+  }
+  if ( dir == NULL ) {
+    perror("malloc");
+    exit(errno);
+  }
+
+  if ( mkdir(dir, 0700) < 0 && errno == ENOENT ) {	// its parents first
+    for ( p = strchr(dir + 1, '/'); p != NULL; p = strchr(p + 1, '/') ) {
+      *p = '\0';
+      if ( mkdir(dir, 0700) < 0 && errno != EEXIST )
+	break;
+      *p = '/';
+    }
+    if ( p == NULL )
+      mkdir(dir, 0700);
+  }
+  if ( p != NULL || access(dir, W_OK) < 0 ) {	// p: a parent that can't be made
+    perror(dir);
+    free(dir);
+    return NULL;
+  }
+  return dir;
+} /*---------- End of cacheDir ----------------------------------------------*/
+
+/*-----------------------------------------------------------------------------
+ *
+ * Name...........: hash
+ *
+ * Description....: adds bytes to a hash (64-bit FNV-1a).
+ *
+ * Input Param(s).: uint64_t h -- the hash so far
+ *		const void *p, size_t n -- the bytes
+ *
+ * Return Value(s): the new hash
+ *
+ */
+
+static uint64_t hash(uint64_t h, const void *p, size_t n)
+{
+  const unsigned char *b = p;
+
+  while ( n-- > 0 ) {
+    h ^= *b++;
+    h *= FNV_PRIME;
+  }
+  return h;
+} /*---------- End of hash ---------------------------------------------------*/
+
+/*-----------------------------------------------------------------------------
+ *
+ * Name...........: hashFile
+ *
+ * Description....: adds to a hash what tells whether a file has changed,
+ * if the word names a file.
+ *
+ * Input Param(s).: uint64_t h -- the hash so far
+ *		const char *name -- the word
+ *
+ * Return Value(s): the new hash
+ *
+ */
+
+static uint64_t hashFile(uint64_t h, const char *name)
+{
+  struct stat st;
+
+  if ( stat(name, &st) < 0 || !S_ISREG(st.st_mode) )
+    return h;
+  h = hash(h, &st.st_dev, sizeof(st.st_dev));
+  h = hash(h, &st.st_ino, sizeof(st.st_ino));
+  h = hash(h, &st.st_size, sizeof(st.st_size));
+  h = hash(h, &st.st_mtim, sizeof(st.st_mtim));
+  return hash(h, &st.st_ctim, sizeof(st.st_ctim));
+} /*---------- End of hashFile ----------------------------------------------*/
+
+/*........................ end of memo.c ....................................*/
@@ -0,0 +1,18 @@
+/******************************************************************************
+ *
+ *  File Name........: memo.h
+ *
+ *  Description......: header file for the output cache of memo.
+ *
+ *****************************************************************************/
+
+#ifndef MEMO_H
+#define MEMO_H
+
+char *memoPath(char **, int, char **, int, char **, int);
+int memoReplay(const char *, int);
+int memoCreate(const char *, char **);
+int memoKeep(const char *, const char *, int);
+
+#endif /* MEMO_H */
+/*........................ end of memo.h ....................................*/
@@ -11,38 +11,85 @@
  *
  *****************************************************************************/
 #include <stdio.h>
+#include <stdio_ext.h>
 #include <stdlib.h>
 #include <errno.h>
 #include <string.h>
 #include <assert.h>
 #include "parse.h"
+#include "var.h"
 
 #define ERR_MSG		"Invalid input\n"
-#define BUF_SIZE        63
+#define BUF_SIZE        1023
 #define EOS             '\0'    // end of string 
+#define MAX_HERE	16	// here documents per line
+#define MAX_SOURCE	32	// inputs pushed by parsePush()
+#define MAX_ALIAS	20	// aliases in the first word of a command
 #define Next()		do { LookAhead = nextToken(); } while (0)
 #define LA		LookAhead
-#define ReadChar(c)	do {c = getchar(); if (c < 0) return Terror;} while (0)
+#define ReadChar(c)	do {c = inGet(); if (c < 0) return Terror;} while (0)
 
 // token is valid in a cmd
 #define InCmd(t)	((t)==Tword||(t)==Tin||(t)==Tout|| \
-			 (t)==Tapp||(t)==ToutErr||(t)==TappErr)
+			 (t)==Tapp||(t)==ToutErr||(t)==TappErr|| \
+			 (t)==Theredoc||(t)==Therestr||(t)==Tdup|| \
+			 (t)==Tlbrace||(t)==Trbrace)
 // token connects pipes
 #define PipeToken(t)	((t)==Tpipe||(t)==TpipeErr)
 
 // token indicates end of cmd
 #define CmdToken(t)	((t)==Tsemi||(t)==Tamp)
 
+// token makes the next pipe conditional
+#define CondToken(t)	((t)==Tand||(t)==Tor)
+
 // token indicates end of line of input
 #define EndOfInput(t)	((t)==Tend||(t)==Tnl||(t)==Terror)
 
+// a plain { or } word opens or closes a group, if it starts a command
+#define WordToken(w, q)	((q) ? Tword : strcmp(w, "{") == 0 ? Tlbrace : \
+			 strcmp(w, "}") == 0 ? Trbrace : Tword)
+
+// token indicates end of a list of pipes (a line or a group)
+#define EndOfList(t)	(EndOfInput(t)||(t)==Trparen||(t)==Trbrace)
+
+// character of a variable name
+#define NameChar(c)	(((c) >= 'a' && (c) <= 'z') || ((c) >= 'A' && (c) <= 'Z') \
+			 || ((c) >= '0' && (c) <= '9') || (c) == '_')
+
 // static variables
 char *_empty="empty";
 char *_endd="end";
-static struct cmd_t Empty={Tnil, Tnil, Tnil,"","",1,1,&_empty,NULL};
-static struct cmd_t End={Tnil, Tnil, Tnil,"","",1,1,&_endd,NULL};
+static struct cmd_t Empty={.exec=Tnil, .in=Tnil, .out=Tnil, .redir=NULL,
+			  .nargs=1, .maxargs=1, .args=&_empty, .next=NULL,
+			  .sub=NULL};
+static struct cmd_t End={.exec=Tend, .in=Tnil, .out=Tnil, .redir=NULL,
+			.nargs=1, .maxargs=1, .args=&_endd, .next=NULL,
+			.sub=NULL};
 static Token LookAhead;
-static char Word[BUF_SIZE+1];	// this value is valid when LookAhead == Tword
+static int RedirFd;		// descriptor of the last redirection token
+static int FdPrefix = -1;	// the n of n< or n>, for the next token
+static FILE *Input;		// where parse() reads from, stdin by default
+static unsigned char *Back;	// chars put back into Input, last one read first
+static int NBack, BackSize;
+
+/* inputs to go back to, with what was put back into them, see parsePush() */
+static struct {
+  FILE *f;
+  unsigned char *back;
+  int nback, size;
+} Pushed[MAX_SOURCE];
+static int NPushed;
+static int Parens;		// ( words ) being read, their operators are words
+
+/* here documents of the current line, their text follows the line */
+static struct {
+  char *delim;			// line ending the text
+  Redir r;			// redirection it is for, NULL if gone
+} Here[MAX_HERE];
+static int NHere;
+static char Word[BUF_SIZE+2];	// this value is valid when LookAhead == Tword
+				// (one spare byte for a CTLESC pair)
 
 // extern functions
 extern void *malloc(size_t);
@@ -54,14 +101,27 @@ static char *mkWord(char *);
 static Cmd newCmd(char *);
 static void freeCmd(Cmd);
 static Cmd mkCmd();
+static int alias();
+static Cmd mkCmdRest(Cmd);
+static int mkRedir(Cmd);
+static Cmd mkGroup();
 static Pipe mkPipe();
 static Token nextToken();
+static int backQuote(char **, int);
+static Token procSubst(char);
+static Token dupFd();
+static Token opWord(char);
+static int dollar(char **, int);
+static void readHere();
+static int inGet();
+static void inUnget(int);
+static Cmd copyCmd(Cmd);
 
 /*-----------------------------------------------------------------------------
  *
  * Name...........: mkCmd
  *
- * Description....: reads stdin and creates a Cmd (struct cmd_t*).  The
+ * Description....: reads input and creates a Cmd (struct cmd_t*).  The
  * Cmd that is returned should be freed with freeCmd().
  *
  * Input Param(s).: Token inpipe -- if in a pipe, then this is the
@@ -78,6 +138,16 @@ static Cmd mkCmd(Token inpipe)
   while ( CmdToken(LA) )	// skip over ; and &
     Next();
 
+  if ( LA == Tword && alias() < 0 )
+    return NULL;
+
+  if ( LA == Tlparen || LA == Tlbrace ) {	// or a group does
+    c = mkGroup();
+    if ( c != NULL )
+      c->in = inpipe;
+    return c;
+  }
+
   if ( LA != Tword ) {		// a word begins every command
     if ( LA == Tend )
       return &End;
@@ -85,6 +155,9 @@ static Cmd mkCmd(Token inpipe)
     if ( LA == Tnl || LA == Terror )
       // don't complain about empty lines or twice about same error
       return &Empty;
+    if ( LA == Trparen || LA == Trbrace )
+      // the caller tells what is wrong with it
+      return NULL;
     printf(ERR_MSG);
 #if 0
     while ( !CmdToken(LA) && !EndOfInput(LA) )	// kill rest of pipe
@@ -97,63 +170,117 @@ static Cmd mkCmd(Token inpipe)
   c = newCmd(Word);
   Next();
   c->in = inpipe;
+  return mkCmdRest(c);
+} /*---------- End of mkCmd -------------------------------------------------*/
 
-  while ( InCmd(LA) ) {		// loop until next command
-    switch ( LA ) {
-    case Tin:
-      if ( c->in != Tnil ) {	// two Tin in one command
-	printf("Ambiguous input redirect.\n");
-	// skip to end of line
-	do {
-	  Next();
-	} while ( !EndOfInput(LA) );
-	freeCmd(c);
-	return NULL;
-      }
-      c->in = LA;
-      Next();
-      if ( LA != Tword ) {
-	printf(ERR_MSG);
-	// skip to end of line
-	do {
-	  Next();
-	} while ( !EndOfInput(LA) );
-	freeCmd(c);
-	return NULL;
-      }	
-      c->infile = mkWord(Word);		// save "in" file
-      Next();
+/*-----------------------------------------------------------------------------
+ *
+ * Name...........: alias
+ *
+ * Description....: replaces the first word of a command, if it is an
+ * alias, by the words of the alias, as in csh.  They are put back in
+ * front of the rest of the line and read again, so an alias may stand
+ * for several commands (alias lm 'ls -l | more') or begin with another
+ * alias.  An alias whose first word is its own name (alias ls ls -F) is
+ * not replaced again.  A quoted word is no alias.
+ *
+ * Input Param(s).: none, the word is in Word
+ *
+ * Return Value(s): 0, or -1 on an alias loop (message printed, the rest
+ * of the line dropped)
+ *
+ */
+
+static int alias()
+{
+  char *seen[MAX_ALIAS], **words;
+  int n = 0, nwords, i, j, err = 0;
+
+  while ( LA == Tword && (words = aliasGet(Word, &nwords)) != NULL ) {
+    if ( n > 0 && strcmp(Word, seen[n-1]) == 0 )
+      break;			// alias ls ls -F
+    for ( i = 0; i < n && strcmp(Word, seen[i]) != 0; i++ )
+      ;
+    if ( i < n || n == MAX_ALIAS ) {
+      printf("Alias loop.\n");
+      while ( !EndOfInput(LA) )
+	Next();
+      err = 1;
       break;
+    }
+    seen[n++] = strdup(Word);
+
+    inUnget(' ');		// the words go back in reverse
+    for ( i = nwords-1; i >= 0; i-- ) {
+      for ( j = strlen(words[i])-1; j >= 0; j-- )
+	inUnget((unsigned char)words[i][j]);
+      if ( i > 0 )
+	inUnget(' ');
+    }
+    Next();
+  }
+
+  for ( i = 0; i < n; i++ )
+    free(seen[i]);
+  return err ? -1 : 0;
+} /*---------- End of alias --------------------------------------------------*/
+
+/*-----------------------------------------------------------------------------
+ *
+ * Name...........: mkCmdRest
+ *
+ * Description....: reads the arguments and redirections of a command
+ * up to the end of the command.  After the first word, parentheses are
+ * words, and so are operators between them, as in if ( $a < 2 ) or
+ * foreach f ( *.c ).
+ *
+ * Input Param(s).: Cmd c -- the command, its first word (or group)
+ * has been read
+ *
+ * Return Value(s): c, or NULL if there was an error (c is freed).
+ *
+ */
 
+static Cmd mkCmdRest(Cmd c)
+{
+  while ( InCmd(LA) || (LA == Tlparen && c->sub == NULL) ||
+	  (LA == Trparen && Parens > 0) ) {	// loop until next command
+    switch ( LA ) {
+    case Tin:
+    case Theredoc:
+    case Therestr:
     case Tout:
     case ToutErr:
     case Tapp:
     case TappErr:
-      if ( c->out != Tnil ) {
-	printf("Ambiguous output redirect.\n");
-	// skip to end of line
-	do {
-	  Next();
-	} while ( !EndOfInput(LA) );
+    case Tdup:
+      if ( mkRedir(c) < 0 ) {
 	freeCmd(c);
 	return NULL;
       }
-      c->out = LA;			// remember which kind
-      Next();
-      if ( LA != Tword) {
+      break;
+
+    case Tlparen:
+      strcpy(Word, "(");
+      Parens++;			// before the next token is read
+      goto word;
+    case Trparen:
+      strcpy(Word, ")");
+      Parens--;
+      goto word;
+
+    case Tlbrace:		// { and } are ordinary words here
+    case Trbrace:
+    case Tword:
+    word:
+      if ( c->sub != NULL ) {	// no words after a group
 	printf(ERR_MSG);
-	// skip to end of line
 	do {
 	  Next();
 	} while ( !EndOfInput(LA) );
 	freeCmd(c);
 	return NULL;
       }
-      c->outfile = mkWord(Word);	// save "out" file
-      Next();
-      break;
-
-    case Tword:
       if ( c->args == NULL ) {
 	printf("Hmmm...\n");
 	exit(-2);
@@ -177,6 +304,7 @@ static Cmd mkCmd(Token inpipe)
       break;
     }
   }
+  Parens = 0;			// unbalanced ones end with the command
   if ( LA == Terror ) {		// shouldn't happen, but what the heck ...
     freeCmd(c);
     return NULL;
@@ -189,7 +317,115 @@ static Cmd mkCmd(Token inpipe)
   }
   c->args[c->nargs] = NULL;
   return c;
-} /*---------- End of mkCmd -------------------------------------------------*/
+} /*---------- End of mkCmdRest ---------------------------------------------*/
+
+/*-----------------------------------------------------------------------------
+ *
+ * Name...........: mkRedir
+ *
+ * Description....: reads a redirection (the current token and its
+ * word) and adds it to the end of the command's list.  The standard
+ * input and output may only be redirected once.
+ *
+ * Input Param(s).: Cmd c -- the command
+ *
+ * Return Value(s): 0, or -1 if there was an error (the rest of the
+ * line is skipped).
+ *
+ */
+
+static int mkRedir(Cmd c)
+{
+  Redir r, *rp;
+
+  r = ckmalloc(sizeof(*r));
+  r->type = LA;
+  r->fd = RedirFd;
+  r->dupfd = -1;
+  r->file = NULL;
+  r->next = NULL;
+  for ( rp = &c->redir; *rp != NULL; rp = &(*rp)->next )
+    ;
+  *rp = r;			// freed with c from here on
+
+  if ( r->type == Tdup ) {	// the word is the descriptor or a -
+    if ( Word[0] != '-' )
+      r->dupfd = atoi(Word);
+    Next();
+    return 0;
+  }
+
+  if ( r->fd == 0 ) {
+    if ( c->in != Tnil ) {	// two Tin in one command
+      printf("Ambiguous input redirect.\n");
+      goto skip;
+    }
+    c->in = r->type;
+  } else if ( r->fd == 1 ) {
+    if ( c->out != Tnil ) {
+      printf("Ambiguous output redirect.\n");
+      goto skip;
+    }
+    c->out = r->type;		// remember which kind
+  }
+  Next();
+  if ( LA != Tword ) {
+    printf(ERR_MSG);
+    goto skip;
+  }
+  r->file = mkWord(Word);	// save the file
+  if ( r->type == Theredoc ) {	// the text comes after this line
+    if ( NHere == MAX_HERE ) {
+      printf("Too many << on one line.\n");
+      goto skip;
+    }
+    Here[NHere].delim = mkWord(Word);
+    Here[NHere++].r = r;
+  }
+  Next();
+  return 0;
+
+ skip:				// skip to end of line
+  while ( !EndOfInput(LA) )
+    Next();
+  return -1;
+} /*---------- End of mkRedir -----------------------------------------------*/
+
+/*-----------------------------------------------------------------------------
+ *
+ * Name...........: mkGroup
+ *
+ * Description....: reads a ( list ) or { list } group, and the
+ * redirections that follow it, which apply to the whole group.
+ *
+ * Input Param(s).: none
+ *
+ * Return Value(s): a Cmd whose sub is the list, or NULL on error.
+ *
+ */
+
+static Cmd mkGroup()
+{
+  Token close;
+  Cmd c;
+
+  close = LA == Tlparen ? Trparen : Trbrace;
+  c = newCmd(LA == Tlparen ? "(" : "{");
+  Next();
+  c->sub = mkPipe();
+  if ( c->sub == NULL || LA != close ) {
+    if ( c->sub != NULL )
+      printf(close == Trparen ? "Unmatched (.\n" : "Missing }.\n");
+    else if ( LA == close )
+      printf("Invalid null command.\n");
+    while ( !EndOfInput(LA) )
+      Next();
+    freeCmd(c);
+    return NULL;
+  }
+  Next();
+  return mkCmdRest(c);
+} /*---------- End of mkGroup -----------------------------------------------*/
 
 /*-----------------------------------------------------------------------------
  *
@@ -219,6 +455,8 @@ static Pipe mkPipe()
   p = ckmalloc(sizeof(*p));
   p->type = Pout;	// set type to Pout until we know differently
   p->head = c;
+  p->conn = Tsemi;
+  p->next = NULL;
 
   while ( PipeToken(LA) ) {
     if ( LA == TpipeErr )
@@ -247,9 +485,21 @@ static Pipe mkPipe()
     c = c->next;
   }
 
-  // read next pipe on the line
-  p->next = NULL;
-  while ( !EndOfInput(LA) ) {
+  if ( CondToken(LA) ) {	// && or ||, there must be a pipe after it
+    p->conn = LA;
+    Next();
+    if ( EndOfList(LA) || CmdToken(LA) || CondToken(LA) ) {
+      if ( LA != Terror )
+	printf("Invalid null command.\n");
+      while ( !EndOfInput(LA) )
+	Next();
+      freePipe(p);
+      return NULL;
+    }
+  }
+
+  // read next pipe on the line (or in the group)
+  while ( !EndOfList(LA) ) {
     p->next = mkPipe();
     if ( !p->next )
       break;
@@ -274,11 +524,267 @@ Pipe parse()
 {
   Pipe p;
 
+  if ( Input == NULL )
+    Input = stdin;
   Next();		// prime lookahead
   p = mkPipe();
+  if ( LA == Trparen || LA == Trbrace ) {	// closes no group
+    printf(LA == Trparen ? "Too many )'s.\n" : "Missing {.\n");
+    while ( !EndOfInput(LA) )
+      Next();
+    freePipe(p);
+    p = NULL;
+  }
+  if ( NHere > 0 )
+    readHere();
   return p;
 } /*---------- End of parse -------------------------------------------------*/
 
+/*-----------------------------------------------------------------------------
+ *
+ * Name...........: parseInput
+ *
+ * Description....: changes the stream parse() reads from.
+ *
+ * Input Param(s).: FILE *f -- the new input
+ *
+ * Return Value(s): the previous input
+ *
+ */
+
+FILE *parseInput(FILE *f)
+{
+  FILE *old;
+
+  old = Input ? Input : stdin;
+  Input = f;
+  return old;
+} /*---------- End of parseInput --------------------------------------------*/
+
+/*-----------------------------------------------------------------------------
+ *
+ * Name...........: parsePush
+ *
+ * Description....: makes parse() read from a file until parsePop(), then
+ * from the input it reads now, for source.  Unlike with parseInput()
+ * the shell's children still drop what has been read ahead of the old
+ * input.
+ *
+ * Input Param(s).: FILE *f -- the new input
+ *
+ * Return Value(s): 0, or -1 if too many are pushed already
+ *
+ */
+
+int parsePush(FILE *f)
+{
+  if ( NPushed == MAX_SOURCE )
+    return -1;
+  Pushed[NPushed].f = Input ? Input : stdin;
+  Pushed[NPushed].back = Back;
+  Pushed[NPushed].nback = NBack;
+  Pushed[NPushed++].size = BackSize;
+  Input = f;
+  Back = NULL;
+  NBack = BackSize = 0;
+  return 0;
+} /*---------- End of parsePush ---------------------------------------------*/
+
+/*-----------------------------------------------------------------------------
+ *
+ * Name...........: parsePop
+ *
+ * Description....: goes back to the input before the last parsePush().
+ *
+ * Input Param(s).: none
+ *
+ * Return Value(s): the input popped, for the caller to close
+ *
+ */
+
+FILE *parsePop()
+{
+  FILE *f;
+
+  f = Input;
+  free(Back);
+  NPushed--;
+  Input = Pushed[NPushed].f;
+  Back = Pushed[NPushed].back;
+  NBack = Pushed[NPushed].nback;
+  BackSize = Pushed[NPushed].size;
+  return f;
+} /*---------- End of parsePop ----------------------------------------------*/
+
+/*-----------------------------------------------------------------------------
+ *
+ * Name...........: parseEnd
+ *
+ * Description....: tells whether the rest of the input is no more than
+ * blanks and empty lines (which are skipped).  Blocks if the input is
+ * a terminal or a pipe.
+ *
+ * Input Param(s).: none
+ *
+ * Return Value(s): 1 at the end of the input, else 0
+ *
+ */
+
+int parseEnd()
+{
+  int c;
+
+  if ( Input == NULL )
+    Input = stdin;
+  while ( (c = inGet()) == ' ' || c == '\t' || c == '\n' )
+    ;
+  if ( c < 0 )
+    return 1;
+  inUnget(c);
+  return 0;
+} /*---------- End of parseEnd ----------------------------------------------*/
+
+/*-----------------------------------------------------------------------------
+ *
+ * Name...........: parseFork
+ *
+ * Description....: called in a child of the shell, which does not read
+ * the shell's input: drops what has been read ahead of it.  Else the
+ * child would give it back when it exits (stdio seeks the descriptor,
+ * which is shared, back to the shell's position at the fork), and the
+ * shell would read those lines again.  The same goes for the inputs
+ * pushed by source, and for what was put back into them.
+ *
+ * Input Param(s).: none
+ *
+ * Return Value(s): none
+ *
+ */
+
+void parseFork()
+{
+  int i;
+
+  __fpurge(Input ? Input : stdin);
+  NBack = 0;
+  for ( i = 0; i < NPushed; i++ ) {
+    __fpurge(Pushed[i].f);
+    Pushed[i].nback = 0;
+  }
+} /*---------- End of parseFork ---------------------------------------------*/
+
+/*-----------------------------------------------------------------------------
+ *
+ * Name...........: inGet
+ *
+ * Description....: reads a char of the input, first those put back by
+ * inUnget().
+ *
+ * Input Param(s).: none
+ *
+ * Return Value(s): the char, or EOF
+ *
+ */
+
+static int inGet()
+{
+  if ( NBack > 0 )
+    return Back[--NBack];
+  return getc(Input);
+} /*---------- End of inGet --------------------------------------------------*/
+
+/*-----------------------------------------------------------------------------
+ *
+ * Name...........: inUnget
+ *
+ * Description....: puts a char back into the input, to be read next.
+ * Unlike ungetc(), which may take back a single char, there is no limit,
+ * so a whole alias can be put back in front of the rest of the line.
+ * The chars are kept with the input they belong to: parsePush() sets
+ * them aside and parsePop() gives them back.
+ *
+ * Input Param(s).: int c -- the char, EOF is ignored
+ *
+ * Return Value(s): none
+ *
+ */
+
+static void inUnget(int c)
+{
+  if ( c < 0 )
+    return;
+  if ( NBack == BackSize ) {
+    BackSize = BackSize ? 2*BackSize : 256;
+    Back = realloc(Back, BackSize);
+    if ( Back == NULL ) {
+      perror("realloc");
+      exit(errno);
+    }
+  }
+  Back[NBack++] = c;
+} /*---------- End of inUnget ------------------------------------------------*/
+
+/*-----------------------------------------------------------------------------
+ *
+ * Name...........: readHere
+ *
+ * Description....: reads the text of the here documents (<<word) of the
+ * line just parsed: for each, the lines up to one that is exactly the
+ * word.  The text replaces the word in the redirection.  The text
+ * is read even if the command was dropped because of an error, so it
+ * is not taken for commands.
+ *
+ * Input Param(s).: none
+ *
+ * Return Value(s): none
+ *
+ */
+
+static void readHere()
+{
+  size_t len, size, start;
+  char *text;
+  int i, c;
+
+  for ( i = 0; i < NHere; i++ ) {
+    len = 0;
+    size = 256;
+    text = ckmalloc(size);
+    for ( ;; ) {		// one line at a time
+      start = len;
+      while ( (c = inGet()) >= 0 ) {
+	if ( len + 2 > size ) {	// room for c and EOS
+	  size *= 2;
+	  text = realloc(text, size);
+	  if ( text == NULL ) {
+	    perror("realloc");
+	    exit(errno);
+	  }
+	}
+	if ( c == '\n' )
+	  break;
+	text[len++] = c;
+      }
+      text[len] = EOS;
+      if ( strcmp(text+start, Here[i].delim) == 0 ) {
+	len = start;		// drop the end line
+	break;
+      }
+      if ( c < 0 )		// end of input, take what we have
+	break;
+      text[len++] = '\n';	// there is always room for it
+    }
+    text[len] = EOS;
+    if ( Here[i].r != NULL ) {
+      free(Here[i].r->file);
+      Here[i].r->file = text;
+    } else
+      free(text);
+    free(Here[i].delim);
+  }
+  NHere = 0;
+} /*---------- End of readHere ----------------------------------------------*/
+
 /*-----------------------------------------------------------------------------
  *
  * Name...........: ckmalloc
@@ -350,8 +856,9 @@ static Cmd newCmd(char *cmd)
   c->args[0] = mkWord(cmd);
   c->exec = Tsemi;
   c->in = c->out = Tnil;
-  c->infile = c->outfile = NULL;
+  c->redir = NULL;
   c->next = NULL;
+  c->sub = NULL;
   return c;
 } /*---------- End of newCmd ------------------------------------------------*/
 
@@ -359,7 +866,7 @@ static Cmd newCmd(char *cmd)
  *
  * Name...........: nextToken
  *
- * Description....: reads stdin and returns the next token.
+ * Description....: reads input and returns the next token.
  *
  * Input Param(s).: none
  *
@@ -371,14 +878,19 @@ static Token nextToken()
 {
   char* p;
   char c, q;
+  int quoted = 0;		// a \ was stripped from the word
+  int n;
 
   Word[0] = EOS;
   p = Word;
 
-  c = getchar();
+  c = inGet();
   if ( c < 0 )
     return Tend;
 
+  if ( Parens > 0 && strchr("<>&|", c) != NULL )
+    return opWord(c);
+
   switch ( c ) {
   case ' ':
   case '\t':
@@ -387,35 +899,71 @@ static Token nextToken()
   case '\n':
     return Tnl;
   case '&':
+    ReadChar(c);		// could be a & or a &&
+    if ( c == '&' )
+      return Tand;
+    inUnget(c);		// it's a &, put back the last char
     return Tamp;
   case ';':
     return Tsemi;
+  case '(':
+    return Tlparen;
+  case ')':
+    return Trparen;
   case '<':
+    RedirFd = FdPrefix >= 0 ? FdPrefix : 0;
+    FdPrefix = -1;
+    ReadChar(c);		// could be a <, <<, <<<, <& or <(
+    if ( c == '(' )
+      return procSubst('<');
+    if ( c == '&' )
+      return dupFd();
+    if ( c == '<' ) {
+      ReadChar(c);
+      if ( c == '<' )
+	return Therestr;
+      inUnget(c);		// it's a <<, put back last char
+      return Theredoc;
+    }
+    inUnget(c);		// it's a <, put back last char
     return Tin;
 
-  case '|':			// could be a | or a |&
+  case '|':			// could be a |, |& or ||
     ReadChar(c);
     if ( c == '&' )
       return TpipeErr;
-    ungetc(c, stdin);		// it's a |, put back the last char
+    if ( c == '|' )
+      return Tor;
+    inUnget(c);		// it's a |, put back the last char
     return Tpipe;
 
   case '>':
-    ReadChar(c);		// could be a >, >>, or >>&
+    RedirFd = FdPrefix >= 0 ? FdPrefix : 1;
+    FdPrefix = -1;
+    ReadChar(c);		// could be a >, >>, >>&, >&n, >&- or >(
+    if ( c == '(' )
+      return procSubst('>');
     if ( c == '>' ) {
       ReadChar(c);
-      if ( c == '&' )
+      if ( c == '&' ) {
+	RedirFd = 1;
 	return TappErr;
+      }
       else {
-	ungetc(c, stdin);	// it's a >>, put back last char
+	inUnget(c);	// it's a >>, put back last char
 	return Tapp;
       }
     }
     else if ( c == '&' ) {
+      ReadChar(c);
+      inUnget(c);
+      if ( c == '-' || (c >= '0' && c <= '9') )
+	return dupFd();
+      RedirFd = 1;
       return ToutErr;
     }
     else {
-      ungetc(c, stdin);		// it's a >, put back last char
+      inUnget(c);		// it's a >, put back last char
       return Tout;
     }
     break;
@@ -426,7 +974,7 @@ static Token nextToken()
     // process strings
     q = c;
     //    p = Word;
-    c = getchar();
+    c = inGet();
     // get chars until the matching quote character 
     while ( c != q ) {
       if ( c < 0 || c == '\n' ) {	
@@ -434,14 +982,28 @@ static Token nextToken()
 	printf("Unmatched %c\n", q);
 	return Terror;
       }
+      if ( c == '`' && q == '"' ) {	// substituted, but not split
+	if ( backQuote(&p, 1) < 0 )
+	  return Terror;
+	c = inGet();
+	continue;
+      }
+      if ( c == '$' && q == '"' && (n = dollar(&p, 1)) != 0 ) {
+	if ( n < 0 )
+	  return Terror;
+	c = inGet();
+	continue;
+      }
+      if ( ExpChar(c) )
+	*p++ = CTLESC;	// quoted, don't expand it
       *p++ = c;		// copy char to buffer at p
       if ( p > Word + BUF_SIZE ) {
 	printf("String too long (> %d bytes)\n", BUF_SIZE);
-	while ( (c = getchar()) > 0 && c != '\n' )
+	while ( (c = inGet()) > 0 && c != '\n' )
 	  ;
 	return Terror;
       }
-      c = getchar();
+      c = inGet();
     }
     *p++ = EOS;
     p = Word;
@@ -450,13 +1012,24 @@ static Token nextToken()
   default:		// everything else is a word
     //    p = Word;
     while (1) {
-      if ( c == '\\' ) {	// strip \ from stream
-	ReadChar(c);
+      if ( c == '`' ) {
+	if ( backQuote(&p, 0) < 0 )
+	  return Terror;
+      } else if ( c == '$' && (n = dollar(&p, 0)) != 0 ) {
+	if ( n < 0 )
+	  return Terror;
+      } else {
+	if ( c == '\\' ) {	// strip \ from stream
+	  quoted = 1;
+	  ReadChar(c);
+	  if ( ExpChar(c) )
+	    *p++ = CTLESC;	// escaped, don't expand it
+	}
+	*p++ = c;
       }
-      *p++ = c;
       if ( p > Word + BUF_SIZE ) {
 	printf("Word too long (> %d bytes)\n", BUF_SIZE);
-	while ( (c = getchar()) > 0 && c != '\n' )
+	while ( (c = inGet()) > 0 && c != '\n' )
 	  ;
 	return Terror;
       }
@@ -467,17 +1040,27 @@ static Token nextToken()
       case ' ':
       case '\t':
 	*p++ = EOS;
-	return Tword;
+	return WordToken(Word, quoted);
+      case '<':
+      case '>':
+	*p = EOS;
+	if ( !quoted && !Parens && p - Word <= 9 &&
+	     strspn(Word, "0123456789") == (size_t)(p - Word) ) {
+	  FdPrefix = atoi(Word);	// n< or n>, the word is the descriptor
+	  inUnget(c);
+	  return nextToken();
+	}
+	// fall through
       case '\n':
       case '&':
       case ';':
-      case '<':
       case '|':
-      case '>':
+      case '(':
+      case ')':
 	*p++ = EOS;
-	ungetc(c, stdin);	// put back these chars for next time
+	inUnget(c);	// put back these chars for next time
 	p = Word;		// reset p
-	return Tword;
+	return WordToken(Word, quoted);
       case '\'':
       case '\"':
       goto string;
@@ -488,6 +1071,235 @@ static Token nextToken()
   }
 } /*---------- End of nextToken ---------------------------------------------*/
 
+/*-----------------------------------------------------------------------------
+ *
+ * Name...........: backQuote
+ *
+ * Description....: reads a `command` (the opening ` has been read) and
+ * copies the command text to the word, between CTLBACKQ marks, for the
+ * expansion stage to run.  Inside double quotes the first mark is
+ * preceded by CTLESC: the output is then not split into words.
+ *
+ * Input Param(s).: char **pp -- where to copy to, advanced past the copy
+ *		int quoted -- 1 if inside double quotes
+ *
+ * Return Value(s): 0, or -1 on error (the rest of the line is skipped)
+ *
+ */
+
+static int backQuote(char **pp, int quoted)
+{
+  char *p = *pp;
+  int c;
+
+  if ( quoted )
+    *p++ = CTLESC;
+  *p++ = CTLBACKQ;
+  while ( (c = inGet()) != '`' ) {
+    if ( c < 0 || c == '\n' ) {
+      printf("Unmatched `.\n");
+      return -1;
+    }
+    if ( p >= Word + BUF_SIZE - 1 ) {	// leave room for the end mark
+      printf("Word too long (> %d bytes)\n", BUF_SIZE);
+      while ( (c = inGet()) > 0 && c != '\n' )
+	;
+      return -1;
+    }
+    *p++ = c;
+  }
+  *p++ = CTLBACKQ;
+  *pp = p;
+  return 0;
+} /*---------- End of backQuote ---------------------------------------------*/
+
+/*-----------------------------------------------------------------------------
+ *
+ * Name...........: dollar
+ *
+ * Description....: reads a $name, ${name}, $?name, $#name or $$ (the $
+ * has been read) and copies the name, between CTLVAR marks, to the word
+ * for the expansion stage to substitute.  Inside double quotes the first
+ * mark is preceded by CTLESC: the value is then not split into words.
+ * A $ followed by anything else is an ordinary character.
+ *
+ * Input Param(s).: char **pp -- where to copy to, advanced past the copy
+ *		int quoted -- 1 if inside double quotes
+ *
+ * Return Value(s): 1, 0 if the $ is not a variable (nothing is read), or
+ * -1 on error (the rest of the line is skipped)
+ *
+ */
+
+static int dollar(char **pp, int quoted)
+{
+  char *p = *pp;
+  int c, brace = 0;
+
+  c = inGet();
+  if ( c == '{' ) {
+    brace = 1;
+    c = inGet();
+  }
+  if ( !NameChar(c) && c != '?' && c != '#' && c != '$' && c != '*' ) {
+    if ( brace ) {
+      printf("Missing }.\n");
+      while ( c > 0 && c != '\n' )
+	c = inGet();
+      return -1;
+    }
+    inUnget(c);		// not a variable
+    return 0;
+  }
+
+  if ( quoted )
+    *p++ = CTLESC;
+  *p++ = CTLVAR;
+  *p++ = c;
+  if ( c != '$' && c != '*' ) {	// $$ and $* are complete
+    if ( c == '?' || c == '#' ) {	// $?name or $#name
+      c = inGet();
+      if ( !NameChar(c) ) {
+	printf("Variable name must contain alphanumeric characters.\n");
+	while ( c > 0 && c != '\n' )
+	  c = inGet();
+	return -1;
+      }
+      *p++ = c;
+    }
+    while ( c = inGet(), NameChar(c) ) {
+      if ( p >= Word + BUF_SIZE - 1 ) {	// leave room for the end mark
+	printf("Word too long (> %d bytes)\n", BUF_SIZE);
+	while ( (c = inGet()) > 0 && c != '\n' )
+	  ;
+	return -1;
+      }
+      *p++ = c;
+    }
+    inUnget(c);
+  }
+  if ( brace && (c = inGet()) != '}' ) {
+    printf("Missing }.\n");
+    while ( c > 0 && c != '\n' )
+      c = inGet();
+    return -1;
+  }
+  *p++ = CTLVAR;
+  *pp = p;
+  return 1;
+} /*---------- End of dollar -------------------------------------------------*/
+
+/*-----------------------------------------------------------------------------
+ *
+ * Name...........: opWord
+ *
+ * Description....: reads an operator between parentheses, which is a
+ * word there: any run of the characters < > = & | ! (the first one has
+ * been read), e.g. <= or &&.
+ *
+ * Input Param(s).: char c -- the first character
+ *
+ * Return Value(s): Tword
+ *
+ */
+
+static Token opWord(char c)
+{
+  char *p = Word;
+
+  do {
+    if ( p < Word + BUF_SIZE )
+      *p++ = c;
+    c = inGet();
+  } while ( c > 0 && strchr("<>=&|!", c) != NULL );
+  if ( c > 0 )
+    inUnget(c);
+  *p = EOS;
+  return Tword;
+} /*---------- End of opWord ------------------------------------------------*/
+
+/*-----------------------------------------------------------------------------
+ *
+ * Name...........: procSubst
+ *
+ * Description....: reads a <(command) or >(command) (up to the opening
+ * parenthesis has been read).  The word is CTLPROC, the direction and
+ * the text of the command, which the expansion stage starts and replaces
+ * by a /dev/fd name.
+ *
+ * Input Param(s).: char dir -- '<' or '>'
+ *
+ * Return Value(s): Tword, or Terror
+ *
+ */
+
+static Token procSubst(char dir)
+{
+  char *p = Word;
+  int c, depth = 1;
+
+  *p++ = CTLPROC;
+  *p++ = dir;
+  for ( ;; ) {
+    c = inGet();
+    if ( c < 0 || c == '\n' ) {
+      printf("Unmatched (.\n");
+      return Terror;
+    }
+    if ( c == '(' )
+      depth++;
+    else if ( c == ')' && --depth == 0 )
+      break;
+    if ( p >= Word + BUF_SIZE ) {
+      printf("Word too long (> %d bytes)\n", BUF_SIZE);
+      while ( (c = inGet()) > 0 && c != '\n' )
+	;
+      return Terror;
+    }
+    *p++ = c;
+  }
+  *p = EOS;
+  return Tword;
+} /*---------- End of procSubst ---------------------------------------------*/
+
+/*-----------------------------------------------------------------------------
+ *
+ * Name...........: dupFd
+ *
+ * Description....: reads the descriptor of a <&n or >&n (up to the &
+ * has been read) into the word, or a - for <&- and >&-.
+ *
+ * Input Param(s).: none
+ *
+ * Return Value(s): Tdup, or Terror
+ *
+ */
+
+static Token dupFd()
+{
+  char *p = Word;
+  int c;
+
+  c = inGet();
+  if ( c == '-' )
+    *p++ = c;
+  else {
+    while ( c >= '0' && c <= '9' && p < Word + 9 ) {
+      *p++ = c;
+      c = inGet();
+    }
+    inUnget(c);
+  }
+  *p = EOS;
+  if ( p == Word ) {
+    printf(ERR_MSG);
+    while ( c > 0 && c != '\n' )	// skip the rest of the line
+      c = inGet();
+    return Terror;
+  }
+  return Tdup;
+} /*---------- End of dupFd -------------------------------------------------*/
+
 /*-----------------------------------------------------------------------------
  *
  * Name...........: freeCmd
@@ -503,21 +1315,27 @@ static Token nextToken()
 
 static void freeCmd(Cmd c)
 {
+  Redir r;
   int i;
 
   if ( c == NULL || c == &Empty || c == &End ) return;
 
   freeCmd(c->next);
 
-  if ( c->infile )
-    free(c->infile);
-  if ( c->outfile )
-    free(c->outfile);
+  while ( (r = c->redir) != NULL ) {
+    for ( i = 0; i < NHere; i++ )	// its here document is still to be read
+      if ( Here[i].r == r )
+	Here[i].r = NULL;
+    c->redir = r->next;
+    free(r->file);
+    free(r);
+  }
   if ( c->args ) {
     for ( i = 0; i < c->nargs; i++ )
       free(c->args[i]);
     free(c->args);
   }
+  freePipe(c->sub);
   free(c);
 } /*---------- End of freeCmd -----------------------------------------------*/
 
@@ -544,4 +1362,118 @@ void freePipe(Pipe p)
   free(p);
 } /*---------- End of freePipe ----------------------------------------------*/
 
+/*-----------------------------------------------------------------------------
+ *
+ * Name...........: copyPipe
+ *
+ * Description....: makes a copy of a pipe list, for a line that is run
+ * more than once (the expansion stage changes the commands it runs).
+ *
+ * Input Param(s).: 
+ *		Pipe p -- the pipe list
+ *
+ * Return Value(s): the copy, to be freed with freePipe()
+ *
+ */
+
+Pipe copyPipe(Pipe p)
+{
+  Pipe q;
+
+  if ( p == NULL )
+    return NULL;
+
+  q = ckmalloc(sizeof(*q));
+  *q = *p;
+  q->head = copyCmd(p->head);
+  q->next = copyPipe(p->next);
+  return q;
+} /*---------- End of copyPipe ----------------------------------------------*/
+
+/*-----------------------------------------------------------------------------
+ *
+ * Name...........: copyCmd
+ *
+ * Description....: makes a copy of a command and those following it in
+ * its pipe.
+ *
+ * Input Param(s).: 
+ *		Cmd c -- the command
+ *
+ * Return Value(s): the copy
+ *
+ */
+
+static Cmd copyCmd(Cmd c)
+{
+  Cmd d;
+  Redir r, *rp;
+  int i;
+
+  if ( c == NULL || c == &Empty || c == &End )
+    return c;
+
+  d = ckmalloc(sizeof(*d));
+  *d = *c;
+  d->maxargs = c->nargs + 1;
+  d->args = ckmalloc(d->maxargs*sizeof(char *));
+  for ( i = 0; i < c->nargs; i++ )
+    d->args[i] = mkWord(c->args[i]);
+  d->args[i] = NULL;
+  rp = &d->redir;
+  for ( r = c->redir; r != NULL; r = r->next ) {
+    *rp = ckmalloc(sizeof(**rp));
+    **rp = *r;
+    if ( r->file != NULL )
+      (*rp)->file = mkWord(r->file);
+    rp = &(*rp)->next;
+  }
+  *rp = NULL;
+  d->next = copyCmd(c->next);
+  d->sub = copyPipe(c->sub);
+  return d;
+} /*---------- End of copyCmd -----------------------------------------------*/
+
+/*-----------------------------------------------------------------------------
+ *
+ * Name...........: wordPipe
+ *
+ * Description....: makes a pipe of a single command from words, e.g.
+ * the words of a foreach list, to be expanded like a command.
+ *
+ * Input Param(s).: 
+ *		char **w -- the words (copied)
+ *		int n -- how many, may be 0
+ *
+ * Return Value(s): the pipe, to be freed with freePipe()
+ *
+ */
+
+Pipe wordPipe(char **w, int n)
+{
+  Pipe p;
+  Cmd c;
+  int i;
+
+  c = newCmd("");
+  free(c->args[0]);
+  c->maxargs = n + 1;
+  c->args = realloc(c->args, c->maxargs*sizeof(char *));
+  if ( c->args == NULL ) {
+    perror("realloc");
+    exit(errno);
+  }
+  for ( i = 0; i < n; i++ )
+    c->args[i] = mkWord(w[i]);
+  c->args[n] = NULL;
+  c->nargs = n;
+
+  p = ckmalloc(sizeof(*p));
+  p->type = Pout;
+  p->head = c;
+  p->conn = Tsemi;
+  p->next = NULL;
+  return p;
+} /*---------- End of wordPipe ----------------------------------------------*/
+
 /*........................ end of parse.c ...................................*/
@@ -11,9 +11,47 @@
 #ifndef PARSE_H
 #define PARSE_H
 
+#include <stdio.h>
+
 /* list of all tokens */
 typedef enum {Terror, Tword, Tamp, Tpipe, Tsemi, Tin, Tout,
-	      Tapp, TpipeErr, ToutErr, TappErr, Tnl, Tnil, Tend} Token;
+	      Tapp, TpipeErr, ToutErr, TappErr, Theredoc, Therestr,
+	      Tand, Tor, Tlparen, Trparen, Tlbrace, Trbrace,
+	      Tdup, Tnl, Tnil, Tend} Token;
+
+/* marks the following character of a word as quoted, so that the
+ * expansion stage treats it literally (e.g. a quoted '*' is not a glob)
+ */
+#define CTLESC		'\001'
+
+/* encloses the text of a `command` in a word */
+#define CTLBACKQ	'\002'
+
+/* starts a word that is a <(command) or >(command) */
+#define CTLPROC		'\003'
+
+/* encloses the name of a $variable in a word, $name or ${name} becoming
+ * CTLVAR name CTLVAR (also ?name, #name and $), preceded by CTLESC
+ * inside double quotes
+ */
+#define CTLVAR		'\004'
+
+/* characters that have a meaning to the expansion stage */
+#define ExpChar(c)	((c)=='*'||(c)=='?'||(c)=='[')
+
+/* redirection data structure
+ * linked list, one redir_t for each redirection of a cmd, applied in
+ * the order given
+ */
+struct redir_t {
+  Token type;			/* Tin, Tout, Tapp, ToutErr, TappErr,
+				   Theredoc, Therestr or Tdup */
+  int fd;			/* descriptor redirected (n in n>file) */
+  int dupfd;			/* Tdup: descriptor copied, -1 to close */
+  char *file;			/* file name, for << and <<< the text */
+  struct redir_t *next;
+};
+typedef struct redir_t *Redir;
 
 /* cmd data structure
  * linked list, one cmd_T for each cmd in a pipe 
@@ -21,13 +59,18 @@ typedef enum {Terror, Tword, Tamp, Tpipe, Tsemi, Tin, Tout,
 struct cmd_t {
   Token exec;			/* whether background or foreground */
   Token in, out;		/* determines where input/output comes/goes*/
-  char *infile, *outfile;	/* set if file redirection */
+  Redir redir;			/* file redirections and descriptor copies */
   int nargs, maxargs;		/* num args in args array below (and size) */
   char **args;			/* argv array -- suitable for execv(1) */
   struct cmd_t *next;
+  struct pipe_t *sub;		/* set if a ( ) or { } group, args[0] is
+				   then "(" or "{" */
 };
 typedef struct cmd_t *Cmd;
 
+/* the command parse() returns at the end of the input, args[0] is "end" */
+#define IsEnd(c)	((c)->exec == Tend)
+
 /* pipe type -- either: | or |& */
 typedef enum {Pout, PoutErr} Ptype;
 
@@ -37,12 +80,22 @@ typedef enum {Pout, PoutErr} Ptype;
 struct pipe_t {
   Ptype type;
   Cmd head;
+  Token conn;			/* Tsemi, or Tand/Tor if next only runs when
+				   this pipe succeeds/fails (&& and ||) */
   struct pipe_t *next;
 };
 typedef struct pipe_t *Pipe;
 
 void freePipe(Pipe);
+Pipe copyPipe(Pipe);
+Pipe wordPipe(char **, int);
 Pipe parse();
+FILE *parseInput(FILE *);
+int parsePush(FILE *);
+FILE *parsePop();
+int parseEnd();
+void parseFork();
+void *ckmalloc(unsigned);
 
 #endif /* PARSE_H */
 /*........................ end of parse.h ...................................*/
@@ -0,0 +1,1041 @@
+/******************************************************************************
+ *
+ *  File Name........: script.c
+ *
+ *  Description......:
+ *	Control flow for ush, as in csh:
+ *
+ *	if ( expr ) then ... else if ( expr ) then ... else ... endif
+ *	if ( expr ) command
+ *	while ( expr ) ... end
+ *	foreach name ( words ) ... end
+ *	break and continue, inside a while or foreach
+ *	function name ... end, which defines a command
+ *
+ *  A line that begins one of them is read together with the lines of its
+ *  block (prompting for them at a terminal) and compiled into a small
+ *  program of jumps and tests.  The lines of the block are kept as they
+ *  were parsed, and each time one is executed a copy of it is expanded
+ *  and run, so the body of a loop is read and parsed only once however
+ *  often it runs.
+ *
+ *	An expr is an expression of @ (see expr.c), true if it is not 0,
+ *  or { command }, which is true if the command succeeds.
+ *
+ *	The body of a function is compiled once, like a block, and kept.
+ *  It runs in the shell itself each time the function is called, with
+ *  argv set to the arguments ($1, $2 ... and $* are its words).
+ *
+ *****************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <signal.h>
+#include "parse.h"
+#include "expand.h"
+#include "event.h"
+#include "var.h"
+#include "expr.h"
+#include "script.h"
+
+// the statements, in the order of Keywords
+typedef enum {Knone, Kif, Kelse, Kendif, Kwhile, Kforeach, Kend,
+	      Kbreak, Kcontinue, Kfunction} Keyword;
+
+#define MAX_CALL	100	// nested function calls
+
+// instructions
+typedef enum {Orun, Otest, Ostatus, Ojump, Oforeach, Onext} Op;
+
+/* an instruction of a compiled block */
+struct insn_t {
+  Op op;
+  int jump;			/* Ojump: where to go; Otest, Ostatus: where
+				   to go if false; Onext: when the list is
+				   done.  Chains jumps to patch until then */
+  int not;			/* Ostatus: ! { command } */
+  int slot;			/* Oforeach, Onext: the list of the loop */
+  char *var;			/* Onext: the variable set to each word */
+  Pipe pipe;			/* Orun: the line; Otest: the words of the
+				   expression; Ostatus: the command;
+				   Oforeach: the words of the list */
+};
+
+/* a compiled block */
+struct code_t {
+  struct insn_t *insn;
+  int n, max;			/* num instructions (and size) */
+  int nslot;			/* num foreach lists */
+};
+typedef struct code_t *Code;
+
+/* a loop being compiled */
+struct loop_t {
+  int start;			/* where continue goes */
+  int breaks;			/* chain of the jumps of its breaks */
+  struct loop_t *up;
+};
+
+/* a function */
+struct func_t {
+  char *name;
+  Code code;
+  int calls;			/* running now */
+  int gone;			/* redefined while running, free when done */
+  struct func_t *next;
+};
+typedef struct func_t *Func;
+
+/* the words of a foreach while it runs */
+struct slot_t {
+  char **w;
+  int n, i;			/* num words, next one */
+};
+
+// static variables
+static char *Keywords[] = {"", "if", "else", "endif", "while", "foreach",
+			   "end", "break", "continue", "function"};
+static const char *Prompt;	// for the lines of a block, NULL if none
+static struct loop_t *Loop;	// innermost loop being compiled
+static int Err;			// the block being compiled has an error
+static int Intr;		// the block was interrupted while read
+static Func Funcs;		// the functions, newest first
+static int Depth;		// function calls running
+
+// extern functions and variables
+void process_pipe(Pipe);
+extern int last_status;
+extern int exit_after;
+
+// forward decls
+static Keyword keyword(Pipe);
+static Pipe readLine();
+static Pipe body(Code, int);
+static void define(Pipe, const char *);
+static Func lookup(const char *);
+static void compileLine(Code, Pipe);
+static void compileIf(Code, Pipe);
+static void compileWhile(Code, Pipe);
+static void compileForeach(Code, Pipe);
+static int compileTest(Code, Cmd, int, int);
+static int closeParen(Cmd, int);
+static void dropArgs(Cmd, int);
+static int emit(Code, Op, Pipe);
+static void patch(Code, int, int);
+static void run(Code);
+static int runPipe(Pipe);
+static int interrupted();
+static void freeCode(Code);
+
+/*-----------------------------------------------------------------------------
+ *
+ * Name...........: scriptLine
+ *
+ * Description....: runs a line of input.  If it begins an if, while or
+ * foreach block, the rest of the block is read and compiled first, and
+ * run if there is no error in it.
+ *
+ * Input Param(s).: Pipe p -- the line, as returned by parse() (freed)
+ *		const char *prompt -- prompt for the lines of a block, or NULL
+ *
+ * Return Value(s): none
+ *
+ */
+
+void scriptLine(Pipe p, const char *prompt)
+{
+  Code k;
+  int saved;
+
+  if ( keyword(p) == Knone ) {	// the usual case
+    process_pipe(p);
+    freePipe(p);
+    return;
+  }
+  if ( keyword(p) == Kfunction ) {
+    define(p, prompt);
+    return;
+  }
+
+  k = ckmalloc(sizeof(*k));
+  k->insn = NULL;
+  k->n = k->max = k->nslot = 0;
+  Prompt = prompt;
+  Loop = NULL;
+  Err = Intr = 0;
+  compileLine(k, p);
+
+  if ( Err )
+    last_status = 1;
+  else {
+    saved = exit_after;		// the shell goes on after each line
+    exit_after = 0;
+    run(k);
+    exit_after = saved;
+  }
+  freeCode(k);
+} /*---------- End of scriptLine --------------------------------------------*/
+
+/*-----------------------------------------------------------------------------
+ *
+ * Name...........: scriptFunction
+ *
+ * Description....: tells whether a command is a function.
+ *
+ * Input Param(s).: const char *name -- the command
+ *
+ * Return Value(s): 1 if so, else 0
+ *
+ */
+
+int scriptFunction(const char *name)
+{
+  return lookup(name) != NULL;
+} /*---------- End of scriptFunction ----------------------------------------*/
+
+/*-----------------------------------------------------------------------------
+ *
+ * Name...........: scriptCall
+ *
+ * Description....: runs a function in the shell, with argv set to its
+ * arguments for the time it runs.
+ *
+ * Input Param(s).: Cmd c -- the command, expanded
+ *
+ * Return Value(s): the status of the last command of the function
+ *
+ */
+
+int scriptCall(Cmd c)
+{
+  Func f;
+  char **saved = NULL, **w;
+  int nsaved = 0, i, exit_saved;
+
+  if ( (f = lookup(c->args[0])) == NULL )
+    return 1;
+  if ( Depth == MAX_CALL ) {
+    printf("%s: Too deeply nested.\n", f->name);
+    return 1;
+  }
+
+  if ( (w = varGet("argv", &nsaved)) != NULL ) {	// the caller's
+    saved = ckmalloc((nsaved+1)*sizeof(char *));
+    for ( i = 0; i < nsaved; i++ )
+      saved[i] = strdup(w[i]);
+  }
+  varSet("argv", c->args+1, c->nargs-1);
+
+  f->calls++;
+  Depth++;
+  exit_saved = exit_after;	// its last command is not the shell's
+  exit_after = 0;
+  last_status = 0;
+  run(f->code);
+  exit_after = exit_saved;
+  Depth--;
+  if ( --f->calls == 0 && f->gone ) {
+    free(f->name);
+    freeCode(f->code);
+    free(f);
+  }
+
+  if ( saved != NULL ) {
+    varSet("argv", saved, nsaved);
+    while ( nsaved > 0 )
+      free(saved[--nsaved]);
+    free(saved);
+  } else
+    varUnset("argv");
+  return last_status;
+} /*---------- End of scriptCall --------------------------------------------*/
+
+/*-----------------------------------------------------------------------------
+ *
+ * Name...........: define
+ *
+ * Description....: reads and compiles the body of a function, up to its
+ * end, and defines the function, replacing one of the same name.  A
+ * function line without a name lists the functions.
+ *
+ * Input Param(s).: Pipe p -- the function line (freed)
+ *		const char *prompt -- prompt for the lines of the body, or NULL
+ *
+ * Return Value(s): none
+ *
+ */
+
+static void define(Pipe p, const char *prompt)
+{
+  Cmd c = p->head;
+  Func f, *fp;
+  Code k;
+  Pipe end;
+
+  if ( c->nargs == 1 && c->redir == NULL && c->next == NULL ) {
+    for ( f = Funcs; f != NULL; f = f->next )
+      printf("%s\n", f->name);
+    freePipe(p);
+    last_status = 0;
+    return;
+  }
+
+  k = ckmalloc(sizeof(*k));
+  k->insn = NULL;
+  k->n = k->max = k->nslot = 0;
+  Prompt = prompt;
+  Loop = NULL;
+  Err = Intr = 0;
+  if ( c->nargs != 2 || strchr(c->args[1], '/') != NULL || c->redir != NULL ||
+       c->next != NULL || p->next != NULL ) {
+    printf("function: Syntax Error.\n");
+    Err = 1;
+  }
+  end = body(k, 1 << Kend);
+  if ( end == NULL ) {
+    if ( !Intr )
+      printf("function: end not found.\n");
+  } else
+    freePipe(end);
+
+  if ( Err ) {
+    freeCode(k);
+    freePipe(p);
+    last_status = 1;
+    return;
+  }
+
+  for ( fp = &Funcs; *fp != NULL; fp = &(*fp)->next )
+    if ( strcmp((*fp)->name, c->args[1]) == 0 ) {
+      f = *fp;
+      *fp = f->next;
+      if ( f->calls > 0 )	// it is redefining itself
+	f->gone = 1;
+      else {
+	free(f->name);
+	freeCode(f->code);
+	free(f);
+      }
+      break;
+    }
+  f = ckmalloc(sizeof(*f));
+  f->name = strdup(c->args[1]);
+  f->code = k;
+  f->calls = f->gone = 0;
+  f->next = Funcs;
+  Funcs = f;
+  freePipe(p);
+  last_status = 0;
+} /*---------- End of define -------------------------------------------------*/
+
+/*-----------------------------------------------------------------------------
+ *
+ * Name...........: lookup
+ *
+ * Description....: finds a function.
+ *
+ * Input Param(s).: const char *name -- its name
+ *
+ * Return Value(s): the function, or NULL if there is none
+ *
+ */
+
+static Func lookup(const char *name)
+{
+  Func f;
+
+  for ( f = Funcs; f != NULL; f = f->next )
+    if ( strcmp(f->name, name) == 0 )
+      return f;
+  return NULL;
+} /*---------- End of lookup -------------------------------------------------*/
+
+/*-----------------------------------------------------------------------------
+ *
+ * Name...........: keyword
+ *
+ * Description....: tells which statement a line is.
+ *
+ * Input Param(s).: Pipe p -- the line
+ *
+ * Return Value(s): the keyword of its first word, Knone if it is none
+ *
+ */
+
+static Keyword keyword(Pipe p)
+{
+  Keyword k;
+
+  if ( p == NULL || p->head->sub != NULL || IsEnd(p->head) )
+    return Knone;
+  for ( k = Kif; k <= Kfunction; k++ )
+    if ( strcmp(p->head->args[0], Keywords[k]) == 0 )
+      return k;
+  return Knone;
+} /*---------- End of keyword ------------------------------------------------*/
+
+/*-----------------------------------------------------------------------------
+ *
+ * Name...........: readLine
+ *
+ * Description....: reads the next line of a block, prompting for it if
+ * need be.  Empty lines (and lines with a syntax error) are skipped.
+ *
+ * Input Param(s).: none
+ *
+ * Return Value(s): the line, or NULL at the end of the input or if the
+ * user interrupted (Intr is then set)
+ *
+ */
+
+static Pipe readLine()
+{
+  Pipe p;
+
+  for ( ;; ) {
+    if ( Prompt != NULL ) {
+      printf("%s", Prompt);
+      if ( eventInput(0) == -1 ) {	// CTRL+C drops the block
+	printf("\n");
+	Intr = 1;
+	return NULL;
+      }
+    }
+    p = parse();
+    if ( p == NULL )
+      continue;
+    if ( IsEnd(p->head) ) {
+      freePipe(p);
+      return NULL;
+    }
+    return p;
+  }
+} /*---------- End of readLine -----------------------------------------------*/
+
+/*-----------------------------------------------------------------------------
+ *
+ * Name...........: body
+ *
+ * Description....: reads and compiles the lines of a block up to the
+ * one that ends it.
+ *
+ * Input Param(s).: Code k -- the program
+ *		int stop -- the keywords that end the block, a bit each
+ *
+ * Return Value(s): the line that ended the block, or NULL if the input
+ * ended first
+ *
+ */
+
+static Pipe body(Code k, int stop)
+{
+  Pipe p;
+
+  while ( (p = readLine()) != NULL ) {
+    if ( (1 << keyword(p)) & stop )
+      return p;
+    compileLine(k, p);
+  }
+  Err = 1;
+  return NULL;
+} /*---------- End of body ---------------------------------------------------*/
+
+/*-----------------------------------------------------------------------------
+ *
+ * Name...........: compileLine
+ *
+ * Description....: compiles a line, and the rest of the block it
+ * begins if it does.
+ *
+ * Input Param(s).: Code k -- the program
+ *		Pipe p -- the line (kept or freed)
+ *
+ * Return Value(s): none
+ *
+ */
+
+static void compileLine(Code k, Pipe p)
+{
+  Keyword kw;
+  Pipe q, rest;
+  int i;
+
+  switch ( kw = keyword(p) ) {
+  case Knone:			// up to a statement after a ;
+    for ( q = p; q->next != NULL; q = q->next )
+      if ( q->conn == Tsemi && keyword(q->next) != Knone )
+	break;
+    rest = q->next;
+    q->next = NULL;
+    emit(k, Orun, p);
+    if ( rest != NULL )
+      compileLine(k, rest);
+    return;
+  case Kif:
+    compileIf(k, p);
+    return;
+  case Kwhile:
+    compileWhile(k, p);
+    return;
+  case Kforeach:
+    compileForeach(k, p);
+    return;
+
+  case Kbreak:
+  case Kcontinue:
+    if ( Loop == NULL ) {
+      printf("%s: Not in while/foreach.\n", Keywords[kw]);
+      Err = 1;
+      break;
+    }
+    i = emit(k, Ojump, NULL);
+    if ( kw == Kcontinue )
+      k->insn[i].jump = Loop->start;
+    else {
+      k->insn[i].jump = Loop->breaks;
+      Loop->breaks = i;
+    }
+    if ( p->next != NULL )	// break; cmd
+      compileLine(k, p->next);
+    p->next = NULL;
+    break;
+
+  case Kfunction:
+    printf("function: Not at top level.\n");
+    Err = 1;
+    break;
+  case Kend:
+    printf("end: Not in while/foreach.\n");
+    Err = 1;
+    break;
+  default:			// else and endif
+    printf("%s: Not in if.\n", Keywords[kw]);
+    Err = 1;
+    break;
+  }
+  freePipe(p);
+} /*---------- End of compileLine -------------------------------------------*/
+
+/*-----------------------------------------------------------------------------
+ *
+ * Name...........: compileIf
+ *
+ * Description....: compiles an if ( expr ) command, or an if block with
+ * its else if and else parts.  Each test jumps to the next part if it
+ * is false, each part that has run jumps past the endif.
+ *
+ * Input Param(s).: Code k -- the program
+ *		Pipe p -- the if line (kept or freed)
+ *
+ * Return Value(s): none
+ *
+ */
+
+static void compileIf(Code k, Pipe p)
+{
+  Pipe rest;
+  Cmd c = p->head;
+  int r, test, ends = -1, i;
+
+  r = c->nargs > 1 && strcmp(c->args[1], "(") == 0 ? closeParen(c, 1) : -1;
+  if ( r < 3 ) {
+    printf("if: Expression Syntax.\n");
+    Err = 1;
+    freePipe(p);
+    return;
+  }
+  if ( r + 1 == c->nargs ) {
+    printf("if: Empty if.\n");
+    Err = 1;
+    freePipe(p);
+    return;
+  }
+
+  if ( strcmp(c->args[r+1], "then") != 0 ) {	// if ( expr ) command
+    test = compileTest(k, c, 2, r);
+    rest = p->next;		// the rest of the line runs anyway
+    p->next = NULL;
+    dropArgs(c, r+1);
+    if ( keyword(p) == Knone || keyword(p) == Kbreak ||
+	 keyword(p) == Kcontinue )
+      compileLine(k, p);
+    else {
+      printf("if: Improper then.\n");
+      Err = 1;
+      freePipe(p);
+    }
+    patch(k, test, k->n);
+    if ( rest != NULL )
+      compileLine(k, rest);
+    return;
+  }
+
+  for ( ;; ) {			// the block, from the if or an else if
+    test = -1;
+    if ( r < 0 )		// told already
+      ;
+    else if ( r + 2 != c->nargs || c->redir != NULL || c->next != NULL ||
+	      p->next != NULL ) {
+      printf("%s: Improper then.\n", c->args[0]);
+      Err = 1;
+    } else
+      test = compileTest(k, c, strcmp(c->args[0], "if") == 0 ? 2 : 3, r);
+    freePipe(p);
+
+    p = body(k, 1 << Kelse | 1 << Kendif);
+    if ( p == NULL )
+      break;
+    c = p->head;
+    if ( keyword(p) == Kendif ) {
+      patch(k, test, k->n);
+      break;
+    }
+
+    i = emit(k, Ojump, NULL);	// the part is done
+    k->insn[i].jump = ends;
+    ends = i;
+    patch(k, test, k->n);
+    if ( c->nargs > 1 && strcmp(c->args[1], "if") == 0 ) {
+      r = c->nargs > 2 && strcmp(c->args[2], "(") == 0 ? closeParen(c, 2) : -1;
+      if ( r < 4 || r + 1 == c->nargs || strcmp(c->args[r+1], "then") != 0 ) {
+	printf("else: Expression Syntax.\n");
+	Err = 1;
+	r = -1;			// the block is read all the same
+      }
+      continue;
+    }
+
+    if ( c->nargs > 1 || c->next != NULL || p->next != NULL ) {
+      printf("else: Improper else.\n");
+      Err = 1;
+    }
+    freePipe(p);
+    p = body(k, 1 << Kendif);
+    break;
+  }
+
+  if ( p == NULL ) {
+    if ( !Intr )
+      printf("if: endif not found.\n");
+  } else
+    freePipe(p);
+  patch(k, ends, k->n);
+} /*---------- End of compileIf ---------------------------------------------*/
+
+/*-----------------------------------------------------------------------------
+ *
+ * Name...........: compileWhile
+ *
+ * Description....: compiles a while block: a test that jumps past the
+ * loop if it is false, the body and a jump back to the test.
+ *
+ * Input Param(s).: Code k -- the program
+ *		Pipe p -- the while line (freed)
+ *
+ * Return Value(s): none
+ *
+ */
+
+static void compileWhile(Code k, Pipe p)
+{
+  struct loop_t loop;
+  Cmd c = p->head;
+  int r, test = -1, i;
+
+  loop.start = k->n;
+  loop.breaks = -1;
+  loop.up = Loop;
+  Loop = &loop;
+  r = c->nargs > 1 && strcmp(c->args[1], "(") == 0 ? closeParen(c, 1) : -1;
+  if ( r < 3 || r + 1 != c->nargs || c->redir != NULL || c->next != NULL ||
+       p->next != NULL ) {
+    printf("while: Expression Syntax.\n");
+    Err = 1;
+  } else
+    test = compileTest(k, c, 2, r);
+  freePipe(p);
+  p = body(k, 1 << Kend);
+  i = emit(k, Ojump, NULL);
+  k->insn[i].jump = loop.start;
+  patch(k, test, k->n);
+  patch(k, loop.breaks, k->n);
+  Loop = loop.up;
+
+  if ( p == NULL ) {
+    if ( !Intr )
+      printf("while: end not found.\n");
+  } else
+    freePipe(p);
+} /*---------- End of compileWhile ------------------------------------------*/
+
+/*-----------------------------------------------------------------------------
+ *
+ * Name...........: compileForeach
+ *
+ * Description....: compiles a foreach block: the list is expanded, then
+ * the body runs with the variable set to each word of it in turn.
+ *
+ * Input Param(s).: Code k -- the program
+ *		Pipe p -- the foreach line (freed)
+ *
+ * Return Value(s): none
+ *
+ */
+
+static void compileForeach(Code k, Pipe p)
+{
+  struct loop_t loop;
+  Cmd c = p->head;
+  int r, i, next = -1;
+
+  r = c->nargs > 2 && strcmp(c->args[2], "(") == 0 ? closeParen(c, 2) : -1;
+  if ( c->nargs < 2 || !varName(c->args[1]) ) {
+    printf("foreach: Variable name must begin with a letter.\n");
+    Err = 1;
+  } else if ( r < 0 || r + 1 != c->nargs || c->redir != NULL ||
+	      c->next != NULL || p->next != NULL ) {
+    printf("foreach: Words not parenthesized.\n");
+    Err = 1;
+  } else {
+    i = emit(k, Oforeach, wordPipe(c->args+3, r-3));
+    k->insn[i].slot = k->nslot++;
+    next = emit(k, Onext, NULL);
+    k->insn[next].slot = k->insn[i].slot;
+    k->insn[next].var = strdup(c->args[1]);
+  }
+
+  loop.start = k->n - 1;	// the Onext
+  loop.breaks = -1;
+  loop.up = Loop;
+  Loop = &loop;
+  freePipe(p);
+  p = body(k, 1 << Kend);
+  i = emit(k, Ojump, NULL);
+  k->insn[i].jump = loop.start;
+  patch(k, next, k->n);
+  patch(k, loop.breaks, k->n);
+  Loop = loop.up;
+
+  if ( p == NULL ) {
+    if ( !Intr )
+      printf("foreach: end not found.\n");
+  } else
+    freePipe(p);
+} /*---------- End of compileForeach ----------------------------------------*/
+
+/*-----------------------------------------------------------------------------
+ *
+ * Name...........: compileTest
+ *
+ * Description....: compiles the expression of an if or a while: a
+ * { command } (or ! { command }) is run as a pipe, anything else is
+ * evaluated by exprEval().
+ *
+ * Input Param(s).: Code k -- the program
+ *		Cmd c -- the line
+ *		int from, to -- where the words of the expression are in
+ *		c->args, between the parentheses
+ *
+ * Return Value(s): the test, whose jump is to be patched
+ *
+ */
+
+static int compileTest(Code k, Cmd c, int from, int to)
+{
+  int i, not;
+
+  not = strcmp(c->args[from], "!") == 0;
+  if ( to - from - not > 2 && strcmp(c->args[from+not], "{") == 0 &&
+       strcmp(c->args[to-1], "}") == 0 ) {
+    i = emit(k, Ostatus, wordPipe(c->args+from+not+1, to-from-not-2));
+    k->insn[i].not = not;
+  } else
+    i = emit(k, Otest, wordPipe(c->args+from, to-from));
+  return i;
+} /*---------- End of compileTest -------------------------------------------*/
+
+/*-----------------------------------------------------------------------------
+ *
+ * Name...........: closeParen
+ *
+ * Description....: finds the ) that closes a (.
+ *
+ * Input Param(s).: Cmd c -- the line
+ *		int open -- the index of the ( in c->args
+ *
+ * Return Value(s): the index of the ), or -1 if there is none
+ *
+ */
+
+static int closeParen(Cmd c, int open)
+{
+  int i, depth = 0;
+
+  for ( i = open; i < c->nargs; i++ ) {
+    if ( strcmp(c->args[i], "(") == 0 )
+      depth++;
+    else if ( strcmp(c->args[i], ")") == 0 && --depth == 0 )
+      return i;
+  }
+  return -1;
+} /*---------- End of closeParen --------------------------------------------*/
+
+/*-----------------------------------------------------------------------------
+ *
+ * Name...........: dropArgs
+ *
+ * Description....: removes the first words of a command, the if ( expr )
+ * of an if ( expr ) command.
+ *
+ * Input Param(s).: Cmd c -- the command
+ *		int n -- number of words to remove
+ *
+ * Return Value(s): none
+ *
+ */
+
+static void dropArgs(Cmd c, int n)
+{
+  int i;
+
+  for ( i = 0; i < n; i++ )
+    free(c->args[i]);
+  c->nargs -= n;
+  memmove(c->args, c->args+n, (c->nargs+1)*sizeof(char *));
+} /*---------- End of dropArgs ----------------------------------------------*/
+
+/*-----------------------------------------------------------------------------
+ *
+ * Name...........: emit
+ *
+ * Description....: appends an instruction to the program.
+ *
+ * Input Param(s).: Code k -- the program
+ *		Op op -- the instruction
+ *		Pipe pipe -- its line or words, NULL if none (kept)
+ *
+ * Return Value(s): the index of the instruction
+ *
+ */
+
+static int emit(Code k, Op op, Pipe pipe)
+{
+  struct insn_t *in;
+
+  if ( k->n == k->max ) {
+    k->max = k->max ? 2*k->max : 16;
+    k->insn = realloc(k->insn, k->max*sizeof(*k->insn));
+    if ( k->insn == NULL ) {
+      perror("realloc");
+      exit(errno);
+    }
+  }
+  in = &k->insn[k->n];
+  in->op = op;
+  in->jump = -1;
+  in->not = 0;
+  in->slot = -1;
+  in->var = NULL;
+  in->pipe = pipe;
+  return k->n++;
+} /*---------- End of emit ---------------------------------------------------*/
+
+/*-----------------------------------------------------------------------------
+ *
+ * Name...........: patch
+ *
+ * Description....: sets the target of a chain of jumps.
+ *
+ * Input Param(s).: Code k -- the program
+ *		int chain -- the first jump, -1 if none
+ *		int to -- the target
+ *
+ * Return Value(s): none
+ *
+ */
+
+static void patch(Code k, int chain, int to)
+{
+  int next;
+
+  while ( chain >= 0 ) {
+    next = k->insn[chain].jump;
+    k->insn[chain].jump = to;
+    chain = next;
+  }
+} /*---------- End of patch --------------------------------------------------*/
+
+/*-----------------------------------------------------------------------------
+ *
+ * Name...........: run
+ *
+ * Description....: runs a compiled block.  It stops at an error in an
+ * expression, or at CTRL+C: when a command is killed by it, or, as a
+ * loop made of builtins only runs no command to kill, when it came by
+ * the time the loop goes round.
+ *
+ * Input Param(s).: Code k -- the program
+ *
+ * Return Value(s): none
+ *
+ */
+
+static void run(Code k)
+{
+  struct slot_t *slots, *s;
+  struct insn_t *in;
+  Pipe q;
+  int pc = 0, t;
+  long long v;
+
+  slots = calloc(k->nslot + 1, sizeof(*slots));
+  if ( slots == NULL ) {
+    perror("calloc");
+    exit(errno);
+  }
+
+  while ( pc < k->n ) {
+    in = &k->insn[pc++];
+    switch ( in->op ) {
+    case Orun:
+      if ( runPipe(in->pipe) < 0 )
+	goto done;
+      break;
+
+    case Ostatus:
+      if ( runPipe(in->pipe) < 0 )
+	goto done;
+      if ( (last_status == 0) == in->not )
+	pc = in->jump;
+      break;
+
+    case Otest:
+      q = copyPipe(in->pipe);
+      t = expandList(q->head, 0) < 0 ||
+	exprEval(q->head->args, q->head->nargs, &v) < 0 ? -1 : v != 0;
+      freePipe(q);
+      if ( t < 0 ) {
+	last_status = 1;
+	goto done;
+      }
+      if ( !t )
+	pc = in->jump;
+      break;
+
+    case Ojump:
+      if ( in->jump < pc && interrupted() )	// back to the top of a loop
+	goto done;
+      pc = in->jump;
+      break;
+
+    case Oforeach:		// the words are taken from the expanded copy
+      s = &slots[in->slot];
+      while ( s->n > 0 )
+	free(s->w[--s->n]);
+      free(s->w);
+      s->w = NULL;
+      q = copyPipe(in->pipe);
+      if ( expandList(q->head, 1) < 0 ) {
+	freePipe(q);
+	last_status = 1;
+	goto done;
+      }
+      s->w = q->head->args;
+      s->n = q->head->nargs;
+      s->i = 0;
+      q->head->args = NULL;
+      q->head->nargs = 0;
+      freePipe(q);
+      break;
+
+    case Onext:
+      if ( interrupted() )
+	goto done;
+      s = &slots[in->slot];
+      if ( s->i == s->n )
+	pc = in->jump;
+      else
+	varSet(in->var, &s->w[s->i++], 1);
+      break;
+    }
+  }
+
+ done:
+  for ( s = slots; s < slots + k->nslot; s++ ) {
+    while ( s->n > 0 )
+      free(s->w[--s->n]);
+    free(s->w);
+  }
+  free(slots);
+} /*---------- End of run ----------------------------------------------------*/
+
+/*-----------------------------------------------------------------------------
+ *
+ * Name...........: runPipe
+ *
+ * Description....: runs a copy of a line of a block.
+ *
+ * Input Param(s).: Pipe p -- the line
+ *
+ * Return Value(s): 0, or -1 if it was interrupted
+ *
+ */
+
+static int runPipe(Pipe p)
+{
+  Pipe q;
+
+  q = copyPipe(p);
+  process_pipe(q);
+  freePipe(q);
+  expandFlush();
+  return last_status == 128 + SIGINT ? -1 : 0;
+} /*---------- End of runPipe -----------------------------------------------*/
+
+/*-----------------------------------------------------------------------------
+ *
+ * Name...........: interrupted
+ *
+ * Description....: tells whether a loop is to stop for a CTRL+C, and
+ * sets the status for it if so.
+ *
+ * Input Param(s).: none
+ *
+ * Return Value(s): 1 if it is, else 0
+ *
+ */
+
+static int interrupted()
+{
+  if ( !eventPending() )
+    return 0;
+  last_status = 128 + SIGINT;
+  return 1;
+} /*---------- End of interrupted --------------------------------------------*/
+
+/*-----------------------------------------------------------------------------
+ *
+ * Name...........: freeCode
+ *
+ * Description....: frees a compiled block.
+ *
+ * Input Param(s).: Code k -- the program
+ *
+ * Return Value(s): none
+ *
+ */
+
+static void freeCode(Code k)
+{
+  int i;
+
+  for ( i = 0; i < k->n; i++ ) {
+    freePipe(k->insn[i].pipe);
+    free(k->insn[i].var);
+  }
+  free(k->insn);
+  free(k);
+} /*---------- End of freeCode -----------------------------------------------*/
+
+/*........................ end of script.c ..................................*/
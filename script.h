@@ -0,0 +1,19 @@
+/******************************************************************************
+ *
+ *  File Name........: script.h
+ *
+ *  Description......: header file for the ush control flow statements.
+ *
+ *****************************************************************************/
+
+#ifndef SCRIPT_H
+#define SCRIPT_H
+
+#include "parse.h"
+
+void scriptLine(Pipe, const char *);
+int scriptFunction(const char *);
+int scriptCall(Cmd);
+
+#endif /* SCRIPT_H */
+/*........................ end of script.h ..................................*/
@@ -0,0 +1,353 @@
+/******************************************************************************
+ *
+ *  File Name........: var.c
+ *
+ *  Description......:
+ *	The shell variables of ush, set with set and foreach and
+ *  substituted for $name.  The value of a variable is a list of words
+ *  (set dirs = ( /bin /usr/bin )), a plain value being a list of one.
+ *  The variables are kept in a list sorted by name, which is how set
+ *  shows them.  The aliases of alias are kept the same way, their
+ *  value is the words that replace the name.
+ *
+ *****************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "parse.h"
+#include "expand.h"
+#include "var.h"
+
+/* a shell variable */
+struct var_t {
+  char *name;
+  int n;			// words in the value
+  char **words;			// NULL terminated
+  struct var_t *next;
+};
+typedef struct var_t *Var;
+
+// static variables
+static Var Vars;
+static Var Aliases;
+
+// forward decls
+static void set(Var *, const char *, char **, int);
+static char **get(Var, const char *, int *);
+static void unset(Var *, const char *);
+static void freeWords(char **, int);
+
+/*-----------------------------------------------------------------------------
+ *
+ * Name...........: varName
+ *
+ * Description....: tells whether a word is a valid variable name: a
+ * letter or _, then letters, digits and _.
+ *
+ * Input Param(s).: const char *s -- the word
+ *
+ * Return Value(s): 1 if it is, else 0
+ *
+ */
+
+int varName(const char *s)
+{
+  if ( !((*s >= 'a' && *s <= 'z') || (*s >= 'A' && *s <= 'Z') || *s == '_') )
+    return 0;
+  for ( s++; *s; s++ )
+    if ( !((*s >= 'a' && *s <= 'z') || (*s >= 'A' && *s <= 'Z') ||
+	   (*s >= '0' && *s <= '9') || *s == '_') )
+      return 0;
+  return 1;
+} /*---------- End of varName -----------------------------------------------*/
+
+/*-----------------------------------------------------------------------------
+ *
+ * Name...........: varSet
+ *
+ * Description....: sets a variable, creating it if need be.
+ *
+ * Input Param(s).: const char *name -- its name
+ *		char **words -- its value (copied)
+ *		int n -- number of words
+ *
+ * Return Value(s): none
+ *
+ */
+
+void varSet(const char *name, char **words, int n)
+{
+  set(&Vars, name, words, n);
+} /*---------- End of varSet ------------------------------------------------*/
+
+/*-----------------------------------------------------------------------------
+ *
+ * Name...........: varGet
+ *
+ * Description....: looks up a variable.
+ *
+ * Input Param(s).: const char *name -- its name
+ *		int *n -- set to the number of words of its value
+ *
+ * Return Value(s): the words (NULL terminated, not to be changed), or
+ * NULL if the variable is not set
+ *
+ */
+
+char **varGet(const char *name, int *n)
+{
+  return get(Vars, name, n);
+} /*---------- End of varGet ------------------------------------------------*/
+
+/*-----------------------------------------------------------------------------
+ *
+ * Name...........: varUnset
+ *
+ * Description....: removes a variable, if it is set.
+ *
+ * Input Param(s).: const char *name -- its name
+ *
+ * Return Value(s): none
+ *
+ */
+
+void varUnset(const char *name)
+{
+  unset(&Vars, name);
+} /*---------- End of varUnset ----------------------------------------------*/
+
+/*-----------------------------------------------------------------------------
+ *
+ * Name...........: varList
+ *
+ * Description....: prints the variables and their values, a list of
+ * several words in parentheses.
+ *
+ * Input Param(s).: none
+ *
+ * Return Value(s): none
+ *
+ */
+
+void varList()
+{
+  Var v;
+  int i;
+
+  for ( v = Vars; v != NULL; v = v->next ) {
+    printf("%s\t", v->name);
+    if ( v->n != 1 )
+      printf("(");
+    for ( i = 0; i < v->n; i++ )
+      printf(i ? " %s" : "%s", v->words[i]);
+    printf(v->n != 1 ? ")\n" : "\n");
+  }
+} /*---------- End of varList -----------------------------------------------*/
+
+/*-----------------------------------------------------------------------------
+ *
+ * Name...........: aliasSet
+ *
+ * Description....: sets an alias, replacing the one of that name.
+ *
+ * Input Param(s).: const char *name -- its name
+ *		char **words -- the words it stands for (copied)
+ *		int n -- number of words
+ *
+ * Return Value(s): none
+ *
+ */
+
+void aliasSet(const char *name, char **words, int n)
+{
+  set(&Aliases, name, words, n);
+} /*---------- End of aliasSet ----------------------------------------------*/
+
+/*-----------------------------------------------------------------------------
+ *
+ * Name...........: aliasGet
+ *
+ * Description....: looks up an alias.
+ *
+ * Input Param(s).: const char *name -- its name
+ *		int *n -- set to the number of words it stands for
+ *
+ * Return Value(s): the words (NULL terminated, not to be changed), or
+ * NULL if there is no such alias
+ *
+ */
+
+char **aliasGet(const char *name, int *n)
+{
+  return get(Aliases, name, n);
+} /*---------- End of aliasGet ----------------------------------------------*/
+
+/*-----------------------------------------------------------------------------
+ *
+ * Name...........: aliasUnset
+ *
+ * Description....: removes the aliases whose names match a pattern.
+ *
+ * Input Param(s).: const char *pattern -- e.g. ll or l*
+ *
+ * Return Value(s): none
+ *
+ */
+
+void aliasUnset(const char *pattern)
+{
+  Var *vp;
+
+  for ( vp = &Aliases; *vp != NULL; )
+    if ( globMatch(pattern, (*vp)->name) )
+      unset(vp, (*vp)->name);
+    else
+      vp = &(*vp)->next;
+} /*---------- End of aliasUnset --------------------------------------------*/
+
+/*-----------------------------------------------------------------------------
+ *
+ * Name...........: aliasList
+ *
+ * Description....: prints the aliases, or one of them.
+ *
+ * Input Param(s).: const char *name -- the alias, NULL for all
+ *
+ * Return Value(s): none
+ *
+ */
+
+void aliasList(const char *name)
+{
+  Var v;
+  int i;
+
+  for ( v = Aliases; v != NULL; v = v->next ) {
+    if ( name != NULL && strcmp(v->name, name) != 0 )
+      continue;
+    if ( name == NULL )
+      printf("%s\t", v->name);
+    for ( i = 0; i < v->n; i++ )
+      printf(i ? " %s" : "%s", v->words[i]);
+    printf("\n");
+  }
+} /*---------- End of aliasList ---------------------------------------------*/
+
+/*-----------------------------------------------------------------------------
+ *
+ * Name...........: set
+ *
+ * Description....: sets a variable of a list, creating it if need be.
+ *
+ * Input Param(s).: Var *list -- the list
+ *		const char *name -- its name
+ *		char **words -- its value (copied)
+ *		int n -- number of words
+ *
+ * Return Value(s): none
+ *
+ */
+
+static void set(Var *list, const char *name, char **words, int n)
+{
+  Var v, *vp;
+  int i, cmp = 1;
+
+  for ( vp = list; *vp != NULL; vp = &(*vp)->next )
+    if ( (cmp = strcmp((*vp)->name, name)) >= 0 )
+      break;
+  if ( cmp == 0 ) {
+    v = *vp;
+    freeWords(v->words, v->n);
+  } else {
+    v = ckmalloc(sizeof(*v));
+    v->name = strdup(name);
+    v->next = *vp;
+    *vp = v;
+  }
+
+  v->n = n;
+  v->words = ckmalloc((n+1)*sizeof(char *));
+  for ( i = 0; i < n; i++ )
+    v->words[i] = strdup(words[i]);
+  v->words[n] = NULL;
+} /*---------- End of set ---------------------------------------------------*/
+
+/*-----------------------------------------------------------------------------
+ *
+ * Name...........: get
+ *
+ * Description....: looks up a variable of a list.
+ *
+ * Input Param(s).: Var list -- the list
+ *		const char *name -- its name
+ *		int *n -- set to the number of words of its value
+ *
+ * Return Value(s): the words, or NULL if it is not there
+ *
+ */
+
+static char **get(Var list, const char *name, int *n)
+{
+  Var v;
+  int cmp;
+
+  for ( v = list; v != NULL; v = v->next )
+    if ( (cmp = strcmp(v->name, name)) >= 0 ) {
+      if ( cmp > 0 )
+	break;
+      *n = v->n;
+      return v->words;
+    }
+  return NULL;
+} /*---------- End of get ---------------------------------------------------*/
+
+/*-----------------------------------------------------------------------------
+ *
+ * Name...........: unset
+ *
+ * Description....: removes a variable from a list, if it is there.
+ *
+ * Input Param(s).: Var *list -- the list
+ *		const char *name -- its name
+ *
+ * Return Value(s): none
+ *
+ */
+
+static void unset(Var *list, const char *name)
+{
+  Var v, *vp;
+
+  for ( vp = list; *vp != NULL; vp = &(*vp)->next )
+    if ( strcmp((*vp)->name, name) == 0 ) {
+      v = *vp;
+      *vp = v->next;
+      freeWords(v->words, v->n);
+      free(v->name);
+      free(v);
+      return;
+    }
+} /*---------- End of unset -------------------------------------------------*/
+
+/*-----------------------------------------------------------------------------
+ *
+ * Name...........: freeWords
+ *
+ * Description....: frees the value of a variable.
+ *
+ * Input Param(s).: char **words -- the words
+ *		int n -- how many
+ *
+ * Return Value(s): none
+ *
+ */
+
+static void freeWords(char **words, int n)
+{
+  while ( n > 0 )
+    free(words[--n]);
+  free(words);
+} /*---------- End of freeWords ---------------------------------------------*/
+
+/*........................ end of var.c .....................................*/
@@ -0,0 +1,23 @@
+/******************************************************************************
+ *
+ *  File Name........: var.h
+ *
+ *  Description......: header file for the ush shell variables and aliases.
+ *
+ *****************************************************************************/
+
+#ifndef VAR_H
+#define VAR_H
+
+int varName(const char *);
+void varSet(const char *, char **, int);
+char **varGet(const char *, int *);
+void varUnset(const char *);
+void varList();
+void aliasSet(const char *, char **, int);
+char **aliasGet(const char *, int *);
+void aliasUnset(const char *);
+void aliasList(const char *);
+
+#endif /* VAR_H */
+/*........................ end of var.h .....................................*/
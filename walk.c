@@ -0,0 +1,518 @@
+/******************************************************************************
+ *
+ *  File Name........: walk.c
+ *
+ *  Description......:
+ *	Provides walkGlob(), the expansion of patterns whose first
+ *  component is "**".  "**" matches any number (including zero) of
+ *  directories, so the whole subtree below the starting directory has to
+ *  be enumerated.  The tree is walked by a small pool of threads: each
+ *  worker keeps a deque of directories still to be read, pushes the
+ *  subdirectories it finds and pops from the same end (depth first),
+ *  while idle workers steal from the other end of someone else's deque,
+ *  or sleep until there is something to steal.
+ *  Directories are opened with openat(2) relative to one descriptor for
+ *  the starting directory and read with getdents64(2).
+ *
+ *	Like other shells, the walk does not follow symbolic links to
+ *  directories, nor descend into dot directories unless the pattern
+ *  names them.  Directories below which nothing can match are not read
+ *  at all.
+ *
+ *****************************************************************************/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/limits.h>
+#include "expand.h"
+#include "walk.h"
+
+#define MAX_WORKERS	64
+#define DENTS_SIZE	(64*1024)	// getdents64 buffer, per worker
+
+// getdents64 record, see getdents64(2)
+struct dirent64_t {
+  uint64_t d_ino;
+  int64_t d_off;
+  unsigned short d_reclen;
+  unsigned char d_type;
+  char d_name[];
+};
+
+/* work queue of one worker: directories (relative to the starting
+ * directory) still to be read.  The owner works at the tail, thieves
+ * take from the head.
+ */
+struct deque_t {
+  pthread_mutex_t lock;
+  char **dir;
+  int head, tail, size;
+};
+
+struct walker_t;
+
+struct worker_t {
+  struct walker_t *w;
+  struct deque_t q;
+  char *dents;			/* getdents64 buffer */
+  char **res;			/* matches found by this worker */
+  int nres, maxres;
+  unsigned seed;		/* for picking victims */
+  pthread_t tid;
+};
+
+struct walker_t {
+  int base;			/* fd of the starting directory */
+  const char *prefix;		/* prepended to every match */
+  const char *pat;		/* pattern, relative to base */
+  const char *last;		/* its last component, NULL if "**" */
+  int dirsOnly;			/* pattern ended in '/' */
+  int nworkers;
+  atomic_long pending;		/* directories queued or being read */
+  atomic_long queued;		/* directories in the deques */
+  atomic_int idle;		/* workers waiting on wake */
+  pthread_mutex_t idleLock;
+  pthread_cond_t wake;		/* work queued, or none pending */
+  struct worker_t *worker;
+};
+
+// forward decls
+static int pathMatch(const char *, const char *);
+static int pathPrefix(const char *, const char *);
+static void push(struct deque_t *, char *);
+static char *pop(struct deque_t *);
+static char *steal(struct deque_t *);
+static void readDir(struct worker_t *, char *);
+static void *work(void *);
+
+/*-----------------------------------------------------------------------------
+ *
+ * Name...........: walkGlob
+ *
+ * Description....: expands a pattern starting with a "**" component
+ * below a directory.
+ *
+ * Input Param(s).: const char *dir -- the directory, "" for the current
+ * one, otherwise ending in '/'.  It is also the prefix of every match.
+ *		const char *pat -- the pattern, with its quote marks
+ *		char ***words -- set to a heap array of matches (unsorted)
+ *		int *nwords -- set to the number of matches
+ *
+ * Return Value(s): number of matches, or -1 if dir can't be read
+ *
+ */
+
+int walkGlob(const char *dir, const char *pat, char ***words, int *nwords)
+{
+  struct walker_t w;
+  struct worker_t *wk;
+  char pbuf[PATH_MAX], **all;
+  size_t plen;
+  long ncpu;
+  int i, n;
+
+  plen = strlen(pat);
+  if ( plen >= PATH_MAX )
+    return -1;
+  memcpy(pbuf, pat, plen+1);
+  w.dirsOnly = 0;
+  while ( plen > 0 && pbuf[plen-1] == '/' ) {
+    pbuf[--plen] = '\0';
+    w.dirsOnly = 1;
+  }
+
+  w.base = open(*dir ? dir : ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if ( w.base < 0 )
+    return -1;
+  w.prefix = dir;
+  w.pat = pbuf;
+  w.last = strrchr(pbuf, '/') ? strrchr(pbuf, '/')+1 : pbuf;
+  if ( strcmp(w.last, "**") == 0 )
+    w.last = NULL;
+  atomic_init(&w.queued, 0);
+  atomic_init(&w.idle, 0);
+  pthread_mutex_init(&w.idleLock, NULL);
+  pthread_cond_init(&w.wake, NULL);
+
+  ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+  w.nworkers = ncpu < 1 ? 1 : ncpu > MAX_WORKERS ? MAX_WORKERS : ncpu;
+  w.worker = ckmalloc(w.nworkers*sizeof(struct worker_t));
+  memset(w.worker, 0, w.nworkers*sizeof(struct worker_t));
+  for ( i = 0; i < w.nworkers; i++ ) {
+    wk = &w.worker[i];
+    wk->w = &w;
+    wk->seed = i+1;
+    pthread_mutex_init(&wk->q.lock, NULL);
+  }
+
+  /* Read the top directory in this thread: the helpers are only worth
+     starting if there is more than one directory to go.
+   */
+  atomic_init(&w.pending, 1);
+  readDir(&w.worker[0], strdup(""));
+  if ( atomic_load(&w.pending) > 1 && w.nworkers > 1 ) {
+    for ( i = 1; i < w.nworkers; i++ )
+      if ( pthread_create(&w.worker[i].tid, NULL, work, &w.worker[i]) != 0 )
+	break;
+    n = i;
+    work(&w.worker[0]);
+    for ( i = 1; i < n; i++ )
+      pthread_join(w.worker[i].tid, NULL);
+  } else
+    work(&w.worker[0]);
+  close(w.base);
+
+  // gather the results of all workers
+  for ( n = i = 0; i < w.nworkers; i++ )
+    n += w.worker[i].nres;
+  all = ckmalloc((n+1)*sizeof(char *));
+  for ( n = i = 0; i < w.nworkers; i++ ) {
+    wk = &w.worker[i];
+    if ( wk->nres )
+      memcpy(all+n, wk->res, wk->nres*sizeof(char *));
+    n += wk->nres;
+    free(wk->res);
+    free(wk->q.dir);
+    free(wk->dents);
+    pthread_mutex_destroy(&wk->q.lock);
+  }
+  free(w.worker);
+  pthread_mutex_destroy(&w.idleLock);
+  pthread_cond_destroy(&w.wake);
+
+  *words = all;
+  *nwords = n;
+  return n;
+} /*---------- End of walkGlob -----------------------------------------------*/
+
+/*-----------------------------------------------------------------------------
+ *
+ * Name...........: work
+ *
+ * Description....: worker main loop.  Reads directories from its own
+ * deque, or stolen from another one, until no directory is left anywhere.
+ * When there is nothing to steal but directories are still being read,
+ * it sleeps until one of them queues a subdirectory or the last is done.
+ *
+ * Input Param(s).: void *arg -- the struct worker_t
+ *
+ * Return Value(s): NULL
+ *
+ */
+
+static void *work(void *arg)
+{
+  struct worker_t *self = arg;
+  struct walker_t *w = self->w;
+  char *dir;
+  int i, v;
+
+  for ( ;; ) {
+    dir = pop(&self->q);
+    self->seed = self->seed*1103515245 + 12345;
+    v = (self->seed >> 16) % w->nworkers;	// try all, from a random one
+    for ( i = 0; dir == NULL && i < w->nworkers; i++ )
+      if ( &w->worker[(v+i) % w->nworkers] != self )
+	dir = steal(&w->worker[(v+i) % w->nworkers].q);
+    if ( dir != NULL ) {
+      atomic_fetch_sub(&w->queued, 1);
+      readDir(self, dir);
+      continue;
+    }
+    if ( atomic_load(&w->pending) == 0 )
+      break;
+    pthread_mutex_lock(&w->idleLock);
+    atomic_fetch_add(&w->idle, 1);
+    while ( atomic_load(&w->queued) == 0 && atomic_load(&w->pending) > 0 )
+      pthread_cond_wait(&w->wake, &w->idleLock);
+    atomic_fetch_sub(&w->idle, 1);
+    pthread_mutex_unlock(&w->idleLock);
+  }
+  return NULL;
+} /*---------- End of work --------------------------------------------------*/
+
+/*-----------------------------------------------------------------------------
+ *
+ * Name...........: readDir
+ *
+ * Description....: reads one directory, records the entries that match
+ * the pattern and queues the subdirectories below which something may
+ * match.  An entry is only matched against the whole pattern if its
+ * name matches the last component.
+ *
+ * Input Param(s).: struct worker_t *self -- the worker
+ *		char *dir -- directory relative to the start ("" for the
+ *		start itself); it is freed here.
+ *
+ * Return Value(s): none
+ *
+ */
+
+static void readDir(struct worker_t *self, char *dir)
+{
+  struct walker_t *w = self->w;
+  struct dirent64_t *e;
+  struct stat sb;
+  char rel[PATH_MAX], *s;
+  size_t dlen, nlen, plen;
+  long nread, pos;
+  int fd, isdir, match;
+
+  fd = openat(w->base, *dir ? dir : ".",
+	      O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+  if ( fd < 0 )
+    goto done;
+  if ( self->dents == NULL )
+    self->dents = ckmalloc(DENTS_SIZE);
+
+  dlen = strlen(dir);
+  memcpy(rel, dir, dlen);
+  if ( dlen )
+    rel[dlen++] = '/';
+
+  while ( (nread = syscall(SYS_getdents64, fd, self->dents, DENTS_SIZE)) > 0 ) {
+    for ( pos = 0; pos < nread; pos += e->d_reclen ) {
+      e = (struct dirent64_t *)(self->dents + pos);
+      if ( e->d_name[0] == '.' && (e->d_name[1] == '\0'
+	   || (e->d_name[1] == '.' && e->d_name[2] == '\0')) )
+	continue;
+      nlen = strlen(e->d_name);
+      if ( dlen + nlen + 1 >= PATH_MAX )
+	continue;
+      memcpy(rel+dlen, e->d_name, nlen+1);
+
+      isdir = e->d_type == DT_DIR;
+      if ( e->d_type == DT_UNKNOWN )
+	isdir = fstatat(fd, e->d_name, &sb, AT_SYMLINK_NOFOLLOW) == 0
+		&& S_ISDIR(sb.st_mode);
+
+      match = w->last == NULL || ((e->d_name[0] != '.' || w->last[0] == '.')
+				  && globMatch(w->last, e->d_name));
+      if ( match && (isdir || !w->dirsOnly) && pathMatch(w->pat, rel) ) {
+	plen = strlen(w->prefix);
+	s = ckmalloc(plen + dlen + nlen + 2);
+	memcpy(s, w->prefix, plen);
+	memcpy(s+plen, rel, dlen+nlen+1);
+	if ( w->dirsOnly )
+	  strcat(s, "/");
+	if ( self->nres == self->maxres ) {
+	  self->maxres = self->maxres ? 2*self->maxres : 64;
+	  self->res = realloc(self->res, self->maxres*sizeof(char *));
+	  if ( self->res == NULL ) {
+	    perror("realloc");
+	    exit(errno);
+	  }
+	}
+	self->res[self->nres++] = s;
+      }
+
+      if ( isdir && pathPrefix(w->pat, rel) ) {
+	atomic_fetch_add(&w->pending, 1);
+	atomic_fetch_add(&w->queued, 1);
+	push(&self->q, strdup(rel));
+	if ( atomic_load(&w->idle) > 0 ) {	// see work()
+	  pthread_mutex_lock(&w->idleLock);
+	  pthread_cond_signal(&w->wake);
+	  pthread_mutex_unlock(&w->idleLock);
+	}
+      }
+    }
+  }
+  close(fd);
+
+ done:
+  free(dir);
+  if ( atomic_fetch_sub(&w->pending, 1) == 1 ) {	// the walk is over
+    pthread_mutex_lock(&w->idleLock);
+    pthread_cond_broadcast(&w->wake);
+    pthread_mutex_unlock(&w->idleLock);
+  }
+} /*---------- End of readDir ----------------------------------------------*/
+
+/*-----------------------------------------------------------------------------
+ *
+ * Name...........: pathMatch
+ *
+ * Description....: matches a relative path name against a pattern,
+ * component by component.  "**" matches zero or more directories, not
+ * dot directories, or anything not hidden when it is the last component.
+ *
+ * Input Param(s).: const char *p -- the pattern
+ *		const char *s -- the path name
+ *
+ * Return Value(s): 1 on a match, 0 otherwise
+ *
+ */
+
+static int pathMatch(const char *p, const char *s)
+{
+  char pc[NAME_MAX+1], sc[NAME_MAX+1];
+  const char *pe, *se;
+
+  for ( ;; ) {
+    pe = strchr(p, '/');
+    if ( pe == NULL )
+      pe = p + strlen(p);
+    se = strchr(s, '/');
+    if ( se == NULL )
+      se = s + strlen(s);
+
+    if ( pe - p == 2 && p[0] == '*' && p[1] == '*' ) {
+      if ( *pe == '\0' )	// trailing **, anything not hidden
+	return strrchr(s, '/') ? strrchr(s, '/')[1] != '.' : *s != '.';
+      for ( p = pe+1; *p == '/'; p++ )
+	;
+      for ( ;; ) {
+	if ( pathMatch(p, s) )
+	  return 1;
+	if ( *s == '.' || (s = strchr(s, '/')) == NULL )
+	  return 0;
+	s++;
+      }
+    }
+
+    if ( pe - p > NAME_MAX || se - s > NAME_MAX )
+      return 0;
+    memcpy(pc, p, pe-p);
+    pc[pe-p] = '\0';
+    memcpy(sc, s, se-s);
+    sc[se-s] = '\0';
+    if ( sc[0] == '.' && pc[0] != '.' )	// dot files must be explicit
+      return 0;
+    if ( !globMatch(pc, sc) )
+      return 0;
+
+    if ( *pe == '\0' || *se == '\0' )
+      return *pe == '\0' && *se == '\0';
+    for ( p = pe+1; *p == '/'; p++ )
+      ;
+    s = se+1;
+  }
+} /*---------- End of pathMatch --------------------------------------------*/
+
+/*-----------------------------------------------------------------------------
+ *
+ * Name...........: pathPrefix
+ *
+ * Description....: tells whether a path name below a directory may
+ * match a pattern, i.e. whether the directory is worth reading.  The
+ * components of the directory are matched as in pathMatch(), but the
+ * pattern has to go on past them.
+ *
+ * Input Param(s).: const char *p -- the pattern
+ *		const char *s -- the directory, relative to the start
+ *
+ * Return Value(s): 1 if something below may match, 0 otherwise
+ *
+ */
+
+static int pathPrefix(const char *p, const char *s)
+{
+  char pc[NAME_MAX+1], sc[NAME_MAX+1];
+  const char *pe, *se;
+
+  for ( ;; ) {
+    pe = strchr(p, '/');
+    if ( pe == NULL )
+      pe = p + strlen(p);
+    se = strchr(s, '/');
+    if ( se == NULL )
+      se = s + strlen(s);
+
+    if ( pe - p == 2 && p[0] == '*' && p[1] == '*' ) {
+      for ( p = pe; *p == '/'; p++ )
+	;
+      for ( ;; ) {		// ** takes the components before s
+	if ( *p && pathPrefix(p, s) )
+	  return 1;
+	if ( *s == '.' )	// but no dot directory
+	  return 0;
+	if ( (s = strchr(s, '/')) == NULL )
+	  return 1;		// it takes them all
+	s++;
+      }
+    }
+
+    if ( pe - p > NAME_MAX || se - s > NAME_MAX )
+      return 0;
+    memcpy(pc, p, pe-p);
+    pc[pe-p] = '\0';
+    memcpy(sc, s, se-s);
+    sc[se-s] = '\0';
+    if ( sc[0] == '.' && pc[0] != '.' )
+      return 0;
+    if ( !globMatch(pc, sc) )
+      return 0;
+
+    if ( *pe == '\0' || *se == '\0' )
+      return *pe != '\0';	// the pattern must go deeper than s
+    for ( p = pe+1; *p == '/'; p++ )
+      ;
+    s = se+1;
+  }
+} /*---------- End of pathPrefix -------------------------------------------*/
+
+/*-----------------------------------------------------------------------------
+ *
+ * Name...........: push, pop, steal
+ *
+ * Description....: deque operations.  push and pop are used by the
+ * owner at the tail, steal by other workers at the head.
+ *
+ */
+
+static void push(struct deque_t *q, char *dir)
+{
+  pthread_mutex_lock(&q->lock);
+  if ( q->tail == q->size ) {
+    if ( q->head > 0 ) {	// slide the live part to the front
+      memmove(q->dir, q->dir+q->head, (q->tail-q->head)*sizeof(char *));
+      q->tail -= q->head;
+      q->head = 0;
+    }
+    if ( q->tail == q->size ) {
+      q->size = q->size ? 2*q->size : 64;
+      q->dir = realloc(q->dir, q->size*sizeof(char *));
+      if ( q->dir == NULL ) {
+	perror("realloc");
+	exit(errno);
+      }
+    }
+  }
+  q->dir[q->tail++] = dir;
+  pthread_mutex_unlock(&q->lock);
+}
+
+static char *pop(struct deque_t *q)
+{
+  char *dir = NULL;
+
+  pthread_mutex_lock(&q->lock);
+  if ( q->tail > q->head )
+    dir = q->dir[--q->tail];
+  pthread_mutex_unlock(&q->lock);
+  return dir;
+}
+
+static char *steal(struct deque_t *q)
+{
+  char *dir = NULL;
+
+  pthread_mutex_lock(&q->lock);
+  if ( q->tail > q->head )
+    dir = q->dir[q->head++];
+  pthread_mutex_unlock(&q->lock);
+  return dir;
+} /*---------- End of push, pop, steal -------------------------------------*/
+
+/*........................ end of walk.c ....................................*/
@@ -0,0 +1,15 @@
+/******************************************************************************
+ *
+ *  File Name........: walk.h
+ *
+ *  Description......: header file for the ush recursive ('**') globber.
+ *
+ *****************************************************************************/
+
+#ifndef WALK_H
+#define WALK_H
+
+int walkGlob(const char *, const char *, char ***, int *);
+
+#endif /* WALK_H */
+/*........................ end of walk.h ....................................*/